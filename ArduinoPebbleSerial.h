@@ -8,10 +8,18 @@
 
 #include <Arduino.h>
 #include "utility/OneWireSoftSerial.h"
+#include "utility/transport.h"
 extern "C" {
 #include "utility/PebbleSerial.h"
 };
 
+// The size of the buffer which ArduinoPebbleSerialT stages the bytes it sends in, so each frame is
+// written to the transport in a few calls rather than one per byte. set_tx_buffer() replaces it, and
+// 0 leaves the library writing a byte at a time until it's called.
+#ifndef PEBBLE_DEFAULT_TX_BUFFER_SIZE
+#define PEBBLE_DEFAULT_TX_BUFFER_SIZE 32
+#endif
+
 typedef enum {
   Baud9600,
   Baud14400,
@@ -33,16 +41,80 @@ typedef enum {
   RequestTypeWriteRead
 } RequestType;
 
-class ArduinoPebbleSerial {
+// This is specialized for a transport from utility/transport.h at compile time, for example
+// ArduinoPebbleSerialT<SoftwareSerialTransport<4> >. Only one can be in use at a time.
+template <typename Transport>
+class ArduinoPebbleSerialT {
+public:
+  static void begin(uint8_t *buffer, size_t length, Baud baud, const uint16_t *services,
+                    uint8_t num_services);
+  // Hands over another payload buffer, so the next frame can be received while the sketch is still
+  // reading the last one. Up to PEBBLE_MAX_RX_BUFFERS can be added on top of the one passed to
+  // begin(), and each frame is received into whichever buffer has been free the longest.
+  static bool add_buffer(uint8_t *buffer, size_t length);
+  // Returns false if a payload buffer is too short for one of the sequence guarded values (see
+  // PebbleAttribute in utility/PebbleSerial.h).
+  static bool set_attributes(PebbleAttribute *attributes, uint8_t num_attributes);
+  // Must be called after begin(), which sets up the default TX buffer.
+  static void set_tx_buffer(uint8_t *buffer, size_t length);
+  // Writes each buffer in the background. In hardware mode this is only supported once
+  // PEBBLE_HARDWARE_TX_ASYNC is defined (see utility/board.h), and otherwise has no effect.
+  static void set_tx_async(bool enabled);
+  static void set_decode_in_isr(bool enabled);
+  static void set_stream_handler(PebbleStreamHandler handler);
+  // Returns true once a frame has been received into the payload buffer. The buffer then belongs to
+  // the sketch until the next call to feed() or release(), so nothing is received into it while
+  // the sketch is reading it.
+  static bool feed(uint16_t *service_id, uint16_t *attribute_id, size_t *length, RequestType *type);
+  // The payload buffer of the frame which feed() last returned (or NULL once it's released).
+  static uint8_t *get_payload(void);
+  static void release(void);
+  static bool write(bool success, const uint8_t *payload, size_t length);
+  static bool write_begin(bool success, uint16_t length);
+  static bool write_chunk(const uint8_t *data, uint16_t length);
+  static bool write_end(void);
+  static bool write_compressed(bool success, const uint8_t *payload, size_t length);
+  static bool notify(uint16_t service_id, uint16_t attribute_id);
+  static void set_notify_interval(uint16_t interval_ms);
+  static bool is_connected(void);
+  static bool is_tx_busy(void);
+  static void get_drop_counters(PebbleDropCounters *counters);
+
+private:
+  static void prv_cmd_cb(SmartstrapCmd cmd, uint32_t arg);
+  static void prv_rx_isr_cb(uint8_t data);
+  static bool prv_fill_rx_chunk(void);
+  static void prv_frame_received(SmartstrapRequestType request_type, RequestType *type);
+  static bool prv_prepare_for_read(uint8_t *buffer, size_t length);
+
+  // the buffers the library has, in the order it fills them (the same order they're handed over)
+  static uint8_t *s_buffers[PEBBLE_MAX_RX_BUFFERS + 1];
+  static size_t s_buffer_lengths[PEBBLE_MAX_RX_BUFFERS + 1];
+  static uint8_t s_buffer_start;
+  static uint8_t s_buffer_count;
+  // the buffer of the frame which the sketch has
+  static uint8_t *s_held_buffer;
+  static size_t s_held_length;
+  static uint8_t *s_tx_buffer;
+#if PEBBLE_DEFAULT_TX_BUFFER_SIZE
+  static uint8_t s_default_tx_buffer[PEBBLE_DEFAULT_TX_BUFFER_SIZE];
+#endif
+  static uint8_t s_rx_chunk[32];
+  static uint8_t s_rx_chunk_offset;
+  static uint8_t s_rx_chunk_length;
+  static bool s_tx_async;
+  static bool s_decode_in_isr;
+};
+
+// The original interface, which picks the transport at runtime.
+class ArduinoPebbleSerial : public ArduinoPebbleSerialT<RuntimeTransport> {
 public:
   static void begin_software(uint8_t pin, uint8_t *buffer, size_t length, Baud baud,
                              const uint16_t *services, uint8_t num_services);
   static void begin_hardware(uint8_t *buffer, size_t length, Baud baud, const uint16_t *services,
                              uint8_t num_services);
-  static bool feed(uint16_t *service_id, uint16_t *attribute_id, size_t *length, RequestType *type);
-  static bool write(bool success, const uint8_t *payload, size_t length);
-  static void notify(uint16_t service_id, uint16_t attribute_id);
-  static bool is_connected(void);
 };
 
+#include "utility/ArduinoPebbleSerialT.h"
+
 #endif //__ARDUINO_PEBBLE_SERIAL_H__
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * Just enough of the Teensy 3 core for the Arduino wrapper to build on a host, for
+ * transport_bench.cpp. Serial1 and OneWireSoftSerial are supplied by the benchmark, interrupts are
+ * never disabled and time stands still.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define __MK20DX256__ 1
+
+#define CORE_PIN1_CONFIG (arduino_pin1_config)
+#define PORT_PCR_ODE 0x20
+#define SERIAL_8N1 0x00
+#define SERIAL_8E1 0x06
+
+extern volatile uint32_t arduino_pin1_config;
+
+static inline void serial_format(uint32_t format) {
+  (void)format;
+}
+
+static inline uint32_t millis(void) {
+  return 0;
+}
+
+static inline void noInterrupts(void) {
+}
+
+static inline void interrupts(void) {
+}
+
+class HardwareSerial {
+public:
+  void begin(uint32_t baud);
+  int available(void);
+  int read(void);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t *buffer, size_t length);
+  void flush(void);
+};
+
+extern HardwareSerial Serial1;
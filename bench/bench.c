@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "encoding.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_HAS_CYCLES 0
+#endif
+
+#define MIN_RUN_NS        (200 * 1000 * 1000)
+#define MIN_QUICK_RUN_NS  (1000 * 1000)
+
+static bool s_quick;
+static const char *s_filter;
+
+void bench_init(int argc, char **argv) {
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      s_quick = true;
+    } else if ((strcmp(argv[i], "--filter") == 0) && (i + 1 < argc)) {
+      s_filter = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--quick] [--filter <benchmark>]\n", argv[0]);
+    }
+  }
+}
+
+bool bench_is_quick(void) {
+  return s_quick;
+}
+
+bool bench_enabled(const char *benchmark) {
+  return !s_filter || (strcmp(s_filter, benchmark) == 0);
+}
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t prv_cycles(void) {
+#if BENCH_HAS_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+double bench_run(const BenchCase *bench_case, BenchOp op, void *context) {
+  const uint64_t min_ns = s_quick ? MIN_QUICK_RUN_NS : MIN_RUN_NS;
+  uint64_t iterations = 1;
+  uint64_t elapsed_ns;
+  uint64_t elapsed_cycles;
+  // warm up the caches and the branch predictor
+  op(context);
+  while (true) {
+    const uint64_t start_cycles = prv_cycles();
+    const uint64_t start_ns = bench_now_ns();
+    uint64_t i;
+    for (i = 0; i < iterations; i++) {
+      op(context);
+    }
+    elapsed_ns = bench_now_ns() - start_ns;
+    elapsed_cycles = prv_cycles() - start_cycles;
+    if (elapsed_ns >= min_ns) {
+      break;
+    }
+    // aim for a bit over the minimum on the next attempt
+    iterations = (elapsed_ns > min_ns / 16) ? (iterations * min_ns * 5 / 4 / elapsed_ns + 1) :
+                                              (iterations * 16);
+  }
+
+  const double ns_per_op = (double)elapsed_ns / iterations;
+  printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"length\":%ld,\"escape_percent\":%d,"
+         "\"iterations\":%llu,\"ns_per_op\":%.2f", bench_case->benchmark, bench_case->variant,
+         bench_case->length, bench_case->escape_percent, (unsigned long long)iterations, ns_per_op);
+  if (bench_case->bytes_per_op) {
+    const double total_bytes = (double)bench_case->bytes_per_op * iterations;
+    printf(",\"bytes_per_sec\":%.0f", total_bytes * 1e9 / elapsed_ns);
+    if (BENCH_HAS_CYCLES) {
+      // these are TSC (reference) cycles, which don't follow the CPU's frequency scaling
+      printf(",\"cycles_per_byte\":%.3f", elapsed_cycles / total_bytes);
+    }
+  }
+  printf("}\n");
+  fflush(stdout);
+  return ns_per_op;
+}
+
+void bench_fill_payload(uint8_t *data, size_t length, int escape_percent, uint32_t seed) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    // a simple LCG so that the payloads are the same on every run
+    seed = seed * 1103515245 + 12345;
+    const uint32_t random = seed >> 8;
+    if ((int)(random % 100) < escape_percent) {
+      data[i] = (random & 0x100) ? ENCODING_FLAG : ENCODING_ESCAPE;
+    } else {
+      data[i] = random >> 9;
+      if ((data[i] == ENCODING_FLAG) || (data[i] == ENCODING_ESCAPE)) {
+        data[i] = 0;
+      }
+    }
+  }
+}
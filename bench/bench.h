@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * Helpers shared by the host benchmarks. Each result is printed to stdout as one line of JSON, so
+ * the output of two runs can be compared line by line with a script.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*BenchOp)(void *context);
+
+typedef struct {
+  const char *benchmark;
+  const char *variant;
+  // the payload length and the percentage of its bytes which need escaping, or -1 if they don't
+  // apply to this benchmark
+  long length;
+  int escape_percent;
+  // the number of bytes processed by each op, for the throughput (0 if there isn't one)
+  size_t bytes_per_op;
+} BenchCase;
+
+// Parses the benchmark options: --quick for short runs (i.e. as a smoke test) and --filter <name>
+// to only run one benchmark.
+void bench_init(int argc, char **argv);
+bool bench_is_quick(void);
+bool bench_enabled(const char *benchmark);
+// Times op (which is called with context) until the total is long enough to be meaningful, prints
+// the result and returns the average time per op in nanoseconds.
+double bench_run(const BenchCase *bench_case, BenchOp op, void *context);
+// Fills data with pseudo-random bytes of which roughly escape_percent are flag or escape bytes.
+void bench_fill_payload(uint8_t *data, size_t length, int escape_percent, uint32_t seed);
+uint64_t bench_now_ns(void);
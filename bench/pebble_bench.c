@@ -0,0 +1,244 @@
+/*
+ * Microbenchmarks for the protocol core: CRC throughput, and the cost of decoding a received frame
+ * and encoding a response, across payload lengths (up to a full payload buffer) and densities of
+ * bytes which need escaping. Run with --quick for a smoke test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "crc.h"
+#include "crc_variants.h"
+#include "encoding.h"
+#include "master.h"
+#include "PebbleSerial.h"
+#include "SmartstrapProtocol.h"
+
+#define BENCH_MAX_DATA_LENGTH   1024
+#define BENCH_BUFFER_SIZE       GET_PAYLOAD_BUFFER_SIZE(BENCH_MAX_DATA_LENGTH)
+// every byte of a frame could need escaping, plus the flags either end
+#define BENCH_MAX_FRAME_LENGTH  (2 * (FRAME_MIN_LENGTH + BENCH_BUFFER_SIZE) + 2)
+#define BENCH_TX_BUFFER_SIZE    64
+
+static const long PAYLOAD_LENGTHS[] = { 0, 16, 64, 256, BENCH_BUFFER_SIZE };
+static const int ESCAPE_PERCENTS[] = { 0, 1, 10, 50, 100 };
+static const long CRC_LENGTHS[] = { 1, 16, 256, 4096 };
+
+#define ARRAY_LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[BENCH_BUFFER_SIZE];
+  uint8_t frame[BENCH_MAX_FRAME_LENGTH];
+  size_t frame_length;
+  uint8_t tx_buffer[BENCH_TX_BUFFER_SIZE];
+  uint8_t response[BENCH_BUFFER_SIZE];
+  size_t response_length;
+  bool byte_at_a_time;
+  volatile uint8_t sink;
+  size_t sink_length;
+} FrameBench;
+
+static FrameBench s_frame_bench;
+
+static void prv_sink_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  // stands in for the transport, without the cost of actually sending anything
+  FrameBench *bench = context;
+  if (cmd == SmartstrapCmdWriteByte) {
+    bench->sink = arg;
+    bench->sink_length++;
+  } else if ((cmd == SmartstrapCmdWriteBuffer) || (cmd == SmartstrapCmdWriteBufferAsync)) {
+    bench->sink = bench->tx_buffer[arg - 1];
+    bench->sink_length += arg;
+    if (cmd == SmartstrapCmdWriteBufferAsync) {
+      pebble_ctx_tx_complete(&bench->ctx);
+    }
+  }
+}
+
+static void prv_frame_bench_init(FrameBench *bench, bool use_tx_buffer) {
+  static const uint16_t SERVICES[] = { 0x0000 };
+  pebble_ctx_init(&bench->ctx, prv_sink_callback, bench, PebbleBaud9600, SERVICES,
+                  ARRAY_LENGTH(SERVICES));
+  pebble_ctx_prepare_for_read(&bench->ctx, bench->payload, sizeof(bench->payload));
+  if (use_tx_buffer) {
+    pebble_ctx_set_tx_buffer(&bench->ctx, bench->tx_buffer, sizeof(bench->tx_buffer));
+  }
+}
+
+static bool prv_receive_frame(FrameBench *bench) {
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  bool is_complete = false;
+  if (bench->byte_at_a_time) {
+    size_t i;
+    for (i = 0; i < bench->frame_length; i++) {
+      is_complete = pebble_ctx_handle_byte(&bench->ctx, bench->frame[i], &service_id,
+                                           &attribute_id, &length, &type, 0);
+    }
+  } else {
+    size_t consumed;
+    is_complete = pebble_ctx_handle_bytes(&bench->ctx, bench->frame, bench->frame_length,
+                                          &consumed, &service_id, &attribute_id, &length, &type,
+                                          0);
+  }
+  if (!is_complete) {
+    fprintf(stderr, "the benchmark frame wasn't received\n");
+    exit(1);
+  }
+  // hand the buffer straight back for the next frame
+  pebble_ctx_prepare_for_read(&bench->ctx, bench->payload, sizeof(bench->payload));
+  return is_complete;
+}
+
+
+// CRC
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  uint8_t data[4096];
+  size_t length;
+  volatile uint8_t result;
+} CrcBench;
+
+static void prv_crc_buffer_op(void *context) {
+  CrcBench *bench = context;
+  uint8_t crc = 0;
+  crc8_calculate_buffer(bench->data, bench->length, &crc);
+  bench->result = crc;
+}
+
+static void prv_crc_streaming_op(void *context) {
+  CrcBench *bench = context;
+  uint8_t crc = 0;
+  size_t i;
+  for (i = 0; i < bench->length; i++) {
+    crc8_calculate_byte_streaming(bench->data[i], &crc);
+  }
+  bench->result = crc;
+}
+
+static void prv_crc_full_table_op(void *context) {
+  CrcBench *bench = context;
+  uint8_t crc = 0;
+  crc8_full_table_buffer(bench->data, bench->length, &crc);
+  bench->result = crc;
+}
+
+static void prv_crc_nibble_table_op(void *context) {
+  CrcBench *bench = context;
+  uint8_t crc = 0;
+  crc8_nibble_table_buffer(bench->data, bench->length, &crc);
+  bench->result = crc;
+}
+
+static void prv_bench_crc(void) {
+  static CrcBench bench;
+  bench_fill_payload(bench.data, sizeof(bench.data), 0, 1);
+  size_t i;
+  for (i = 0; i < ARRAY_LENGTH(CRC_LENGTHS); i++) {
+    bench.length = CRC_LENGTHS[i];
+    // "buffer" and "streaming" are the library as configured (by CRC8_USE_FULL_TABLE), and the
+    // other two are crc8_calculate_buffer() built with each table
+    BenchCase bench_case = { "crc", "buffer", CRC_LENGTHS[i], -1, bench.length };
+    bench_run(&bench_case, prv_crc_buffer_op, &bench);
+    bench_case.variant = "streaming";
+    bench_run(&bench_case, prv_crc_streaming_op, &bench);
+    bench_case.variant = "full_table";
+    bench_run(&bench_case, prv_crc_full_table_op, &bench);
+    bench_case.variant = "nibble_table";
+    bench_run(&bench_case, prv_crc_nibble_table_op, &bench);
+  }
+}
+
+
+// Decoding
+////////////////////////////////////////////////////////////////////////////////
+
+static void prv_decode_op(void *context) {
+  prv_receive_frame(context);
+}
+
+static void prv_bench_decode(void) {
+  FrameBench *bench = &s_frame_bench;
+  size_t i;
+  for (i = 0; i < ARRAY_LENGTH(PAYLOAD_LENGTHS); i++) {
+    size_t j;
+    for (j = 0; j < ARRAY_LENGTH(ESCAPE_PERCENTS); j++) {
+      // a raw data write, which is returned to the application as soon as it's decoded
+      uint8_t payload[BENCH_BUFFER_SIZE];
+      bench_fill_payload(payload, PAYLOAD_LENGTHS[i], ESCAPE_PERCENTS[j], i * 100 + j);
+      bench->frame_length = master_encode_frame(bench->frame, false, SmartstrapProfileRawData,
+                                                payload, PAYLOAD_LENGTHS[i]);
+      BenchCase bench_case = { "decode", "handle_bytes", PAYLOAD_LENGTHS[i], ESCAPE_PERCENTS[j],
+                               PAYLOAD_LENGTHS[i] };
+      prv_frame_bench_init(bench, false);
+      bench->byte_at_a_time = false;
+      bench_run(&bench_case, prv_decode_op, bench);
+
+      bench_case.variant = "handle_byte";
+      prv_frame_bench_init(bench, false);
+      bench->byte_at_a_time = true;
+      bench_run(&bench_case, prv_decode_op, bench);
+    }
+  }
+}
+
+
+// Encoding
+////////////////////////////////////////////////////////////////////////////////
+
+static void prv_encode_op(void *context) {
+  FrameBench *bench = context;
+  // each response needs a request, which is a raw data read with no payload
+  prv_receive_frame(bench);
+  if (!pebble_ctx_write(&bench->ctx, true, bench->response, bench->response_length)) {
+    fprintf(stderr, "the benchmark response wasn't sent\n");
+    exit(1);
+  }
+}
+
+static void prv_bench_encode_variant(const char *variant, bool use_tx_buffer) {
+  FrameBench *bench = &s_frame_bench;
+  size_t i;
+  for (i = 0; i < ARRAY_LENGTH(PAYLOAD_LENGTHS); i++) {
+    size_t j;
+    for (j = 0; j < ARRAY_LENGTH(ESCAPE_PERCENTS); j++) {
+      bench->frame_length = master_encode_frame(bench->frame, true, SmartstrapProfileRawData,
+                                                NULL, 0);
+      bench->response_length = PAYLOAD_LENGTHS[i];
+      bench_fill_payload(bench->response, bench->response_length, ESCAPE_PERCENTS[j],
+                         i * 100 + j);
+      BenchCase bench_case = { "encode", variant, PAYLOAD_LENGTHS[i], ESCAPE_PERCENTS[j],
+                               PAYLOAD_LENGTHS[i] };
+      prv_frame_bench_init(bench, use_tx_buffer);
+      bench->byte_at_a_time = false;
+      bench_run(&bench_case, prv_encode_op, bench);
+    }
+  }
+}
+
+static void prv_bench_encode(void) {
+  // one callback per byte, against copying runs of bytes into a staging buffer
+  prv_bench_encode_variant("write_byte", false);
+  prv_bench_encode_variant("tx_buffer", true);
+}
+
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv);
+  if (bench_enabled("crc")) {
+    prv_bench_crc();
+  }
+  if (bench_enabled("decode")) {
+    prv_bench_decode();
+  }
+  if (bench_enabled("encode")) {
+    prv_bench_encode();
+  }
+  return 0;
+}
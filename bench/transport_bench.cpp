@@ -0,0 +1,181 @@
+/*
+ * Compares ArduinoPebbleSerialT with its transport picked at compile time against
+ * ArduinoPebbleSerial, which picks it at runtime, by timing requests through the whole wrapper with
+ * OneWireSoftSerial replaced by a loopback. This is built once for each (as transport_bench_template
+ * and transport_bench_runtime) with unused code stripped the same way an Arduino build does, so
+ * the size of the two executables can be compared as well. Run with --quick for a smoke test.
+ */
+
+#include "ArduinoPebbleSerial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "bench.h"
+#include "master.h"
+}
+
+#define BENCH_MAX_DATA_LENGTH   200
+#define BENCH_BUFFER_SIZE       GET_PAYLOAD_BUFFER_SIZE(BENCH_MAX_DATA_LENGTH)
+#define BENCH_PIN               2
+
+#if TRANSPORT_BENCH_RUNTIME
+typedef ArduinoPebbleSerial Wrapper;
+#define VARIANT "runtime"
+#else
+typedef ArduinoPebbleSerialT<SoftwareSerialTransport<BENCH_PIN> > Wrapper;
+#define VARIANT "template"
+#endif
+
+static const long PAYLOAD_LENGTHS[] = { 4, 16, 64, BENCH_MAX_DATA_LENGTH };
+
+#define ARRAY_LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+
+
+// Loopback
+////////////////////////////////////////////////////////////////////////////////
+
+// The bytes which the "watch" has sent, and a sink for the ones the strap sends back.
+static const uint8_t *s_rx_data;
+static size_t s_rx_length;
+static volatile uint8_t s_tx_sink;
+static size_t s_tx_length;
+
+static void prv_sink(const uint8_t *buffer, size_t length) {
+  s_tx_sink = buffer[length - 1];
+  s_tx_length += length;
+}
+
+void OneWireSoftSerial::begin(uint8_t pin, long speed) {
+  (void)pin;
+  (void)speed;
+}
+
+int OneWireSoftSerial::available() {
+  return s_rx_length;
+}
+
+void OneWireSoftSerial::set_tx_enabled(bool enabled) {
+  (void)enabled;
+}
+
+void OneWireSoftSerial::write(uint8_t byte, bool is_break) {
+  (void)is_break;
+  prv_sink(&byte, 1);
+}
+
+void OneWireSoftSerial::write(const uint8_t *buffer, size_t length) {
+  prv_sink(buffer, length);
+}
+
+void OneWireSoftSerial::write_async(const uint8_t *buffer, size_t length, void (*done)(void)) {
+  prv_sink(buffer, length);
+  done();
+}
+
+int OneWireSoftSerial::read() {
+  if (!s_rx_length) {
+    return -1;
+  }
+  s_rx_length--;
+  return *s_rx_data++;
+}
+
+void OneWireSoftSerial::set_rx_callback(void (*callback)(uint8_t data)) {
+  (void)callback;
+}
+
+uint16_t OneWireSoftSerial::get_rx_overflow_count() {
+  return 0;
+}
+
+uint8_t OneWireSoftSerial::get_rx_high_water_mark() {
+  return 0;
+}
+
+// The hardware serial is only linked in by ArduinoPebbleSerial, and is never actually used.
+volatile uint32_t arduino_pin1_config;
+HardwareSerial Serial1;
+
+void HardwareSerial::begin(uint32_t baud) {
+  (void)baud;
+}
+
+int HardwareSerial::available(void) {
+  return 0;
+}
+
+int HardwareSerial::read(void) {
+  return -1;
+}
+
+size_t HardwareSerial::write(uint8_t data) {
+  prv_sink(&data, 1);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t length) {
+  prv_sink(buffer, length);
+  return length;
+}
+
+void HardwareSerial::flush(void) {
+}
+
+
+// Requests
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  uint8_t payload[BENCH_BUFFER_SIZE];
+  uint8_t frame[MASTER_MAX_FRAME_LENGTH(BENCH_MAX_DATA_LENGTH)];
+  size_t frame_length;
+} RequestBench;
+
+static void prv_begin(RequestBench *bench) {
+  static const uint16_t SERVICES[] = { 0x0000 };
+#if TRANSPORT_BENCH_RUNTIME
+  Wrapper::begin_software(BENCH_PIN, bench->payload, sizeof(bench->payload), Baud57600, SERVICES,
+                          ARRAY_LENGTH(SERVICES));
+#else
+  Wrapper::begin(bench->payload, sizeof(bench->payload), Baud57600, SERVICES,
+                 ARRAY_LENGTH(SERVICES));
+#endif
+}
+
+static void prv_request_op(void *context) {
+  // a raw data write-read, which the sketch echoes back
+  RequestBench *bench = (RequestBench *)context;
+  s_rx_data = bench->frame;
+  s_rx_length = bench->frame_length;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  RequestType type;
+  if (!Wrapper::feed(&service_id, &attribute_id, &length, &type) ||
+      !Wrapper::write(true, Wrapper::get_payload(), length)) {
+    fprintf(stderr, "the benchmark request wasn't handled\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  static RequestBench bench;
+  bench_init(argc, argv);
+  if (!bench_enabled("wrapper_write_read")) {
+    return 0;
+  }
+  size_t i;
+  for (i = 0; i < ARRAY_LENGTH(PAYLOAD_LENGTHS); i++) {
+    uint8_t data[BENCH_MAX_DATA_LENGTH];
+    bench_fill_payload(data, PAYLOAD_LENGTHS[i], 10, i);
+    bench.frame_length = master_encode_frame(bench.frame, true, SmartstrapProfileRawData, data,
+                                             PAYLOAD_LENGTHS[i]);
+    prv_begin(&bench);
+    BenchCase bench_case = { "wrapper_write_read", VARIANT, PAYLOAD_LENGTHS[i], 10,
+                             (size_t)PAYLOAD_LENGTHS[i] };
+    bench_run(&bench_case, prv_request_op, &bench);
+  }
+  return 0;
+}
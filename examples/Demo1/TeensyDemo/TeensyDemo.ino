@@ -2,7 +2,8 @@
 
 static const uint16_t SUPPORTED_SERVICES[] = {0x0000, 0x1001};
 static const uint8_t NUM_SERVICES = 2;
-static uint8_t pebble_buffer[GET_PAYLOAD_BUFFER_SIZE(200)];
+// two payload buffers, so the next frame can be received while loop() is handling the last one
+static uint8_t pebble_buffers[2][GET_PAYLOAD_BUFFER_SIZE(200)];
 
 void setup() {
   // General init
@@ -12,17 +13,18 @@ void setup() {
 
 #if defined(__MK20DX256__) || defined(__MK20DX128__)
   // Teensy 3.0/3.1 uses hardware serial mode (pins 0/1) with RX/TX shorted together
-  ArduinoPebbleSerial::begin_hardware(pebble_buffer, sizeof(pebble_buffer), Baud57600,
+  ArduinoPebbleSerial::begin_hardware(pebble_buffers[0], sizeof(pebble_buffers[0]), Baud57600,
                                       SUPPORTED_SERVICES, NUM_SERVICES);
 #elif defined(__AVR_ATmega32U4__)
   // Teensy 2.0 uses the one-wire software serial mode (pin 2);
   const uint8_t PEBBLE_PIN = 1;
   STATIC_ASSERT_VALID_ONE_WIRE_SOFT_SERIAL_PIN(PEBBLE_PIN);
-  ArduinoPebbleSerial::begin_software(PEBBLE_PIN, pebble_buffer, sizeof(pebble_buffer), Baud57600,
-                                      SUPPORTED_SERVICES, NUM_SERVICES);
+  ArduinoPebbleSerial::begin_software(PEBBLE_PIN, pebble_buffers[0], sizeof(pebble_buffers[0]),
+                                      Baud57600, SUPPORTED_SERVICES, NUM_SERVICES);
 #else
 #error "This example will only work for the Teensy 2.0, 3.0, or 3.1 boards"
 #endif
+  ArduinoPebbleSerial::add_buffer(pebble_buffers[1], sizeof(pebble_buffers[1]));
 }
 
 void loop() {
@@ -32,6 +34,8 @@ void loop() {
   uint16_t attribute_id;
   RequestType type;
   if (ArduinoPebbleSerial::feed(&service_id, &attribute_id, &length, &type)) {
+    // the frame is in whichever of the buffers was free the longest
+    uint8_t *pebble_buffer = ArduinoPebbleSerial::get_payload();
     if ((service_id == 0) && (attribute_id == 0)) {
       // we have a raw data frame to process
       static bool led_status = false;
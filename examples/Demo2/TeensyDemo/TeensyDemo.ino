@@ -6,51 +6,54 @@ static const size_t LED_ATTRIBUTE_LENGTH = 1;
 static const uint16_t UPTIME_ATTRIBUTE_ID = 0x0002;
 static const size_t UPTIME_ATTRIBUTE_LENGTH = 4;
 
-static const uint16_t SERVICES[] = {SERVICE_ID};
-static const uint8_t NUM_SERVICES = 1;
-
 static const uint8_t PEBBLE_DATA_PIN = 1;
 static uint8_t buffer[GET_PAYLOAD_BUFFER_SIZE(4)];
 
 
-void setup() {
-  pinMode(LED_BUILTIN, OUTPUT);
-#if defined(__MK20DX256__) || defined(__MK20DX128__)
-  // Teensy 3.0/3.1 uses hardware serial mode (pins 0/1) with RX/TX shorted together
-  ArduinoPebbleSerial::begin_hardware(buffer, sizeof(buffer), Baud57600, SERVICES, NUM_SERVICES);
-#elif defined(__AVR_ATmega32U4__)
-  // Teensy 2.0 uses the one-wire software serial mode
-  ArduinoPebbleSerial::begin_software(PEBBLE_DATA_PIN, buffer, sizeof(buffer), Baud57600, SERVICES,
-                                      NUM_SERVICES);
-#else
-#error "This example will only work for the Teensy 2.0, 3.0, or 3.1 boards"
-#endif
-}
-
-void handle_uptime_request(RequestType type, size_t length) {
-  if (type != RequestTypeRead) {
-    // unexpected request type
-    return;
-  }
+void handle_uptime_request(PebbleSerialContext *ctx, const PebbleAttribute *attribute,
+                           SmartstrapRequestType type, uint8_t *data, size_t length) {
   // write back the current uptime
   const uint32_t uptime = millis() / 1000;
   ArduinoPebbleSerial::write(true, (uint8_t *)&uptime, sizeof(uptime));
 }
 
-void handle_led_request(RequestType type, size_t length) {
-  if (type != RequestTypeWrite) {
-    // unexpected request type
-    return;
-  } else if (length != LED_ATTRIBUTE_LENGTH) {
+void handle_led_request(PebbleSerialContext *ctx, const PebbleAttribute *attribute,
+                        SmartstrapRequestType type, uint8_t *data, size_t length) {
+  if (length != LED_ATTRIBUTE_LENGTH) {
     // unexpected request length
+    ArduinoPebbleSerial::write(false, NULL, 0);
     return;
   }
   // set the LED
-  digitalWrite(LED_BUILTIN, (bool) buffer[0]);
+  digitalWrite(LED_BUILTIN, (bool) data[0]);
   // ACK that the write request was received
   ArduinoPebbleSerial::write(true, NULL, 0);
 }
 
+// The library only passes requests for these attributes (of the listed types) to the handlers, and
+// the list of supported services is built from this table.
+static PebbleAttribute ATTRIBUTES[] = {
+  {SERVICE_ID, LED_ATTRIBUTE_ID, handle_led_request, LED_ATTRIBUTE_LENGTH,
+   SmartstrapRequestMaskWrite},
+  {SERVICE_ID, UPTIME_ATTRIBUTE_ID, handle_uptime_request, 0, SmartstrapRequestMaskRead},
+};
+static const uint8_t NUM_ATTRIBUTES = sizeof(ATTRIBUTES) / sizeof(ATTRIBUTES[0]);
+
+
+void setup() {
+  pinMode(LED_BUILTIN, OUTPUT);
+#if defined(__MK20DX256__) || defined(__MK20DX128__)
+  // Teensy 3.0/3.1 uses hardware serial mode (pins 0/1) with RX/TX shorted together
+  ArduinoPebbleSerial::begin_hardware(buffer, sizeof(buffer), Baud57600, NULL, 0);
+#elif defined(__AVR_ATmega32U4__)
+  // Teensy 2.0 uses the one-wire software serial mode
+  ArduinoPebbleSerial::begin_software(PEBBLE_DATA_PIN, buffer, sizeof(buffer), Baud57600, NULL, 0);
+#else
+#error "This example will only work for the Teensy 2.0, 3.0, or 3.1 boards"
+#endif
+  ArduinoPebbleSerial::set_attributes(ATTRIBUTES, NUM_ATTRIBUTES);
+}
+
 void loop() {
   if (ArduinoPebbleSerial::is_connected()) {
     static uint32_t last_notify_time = 0;
@@ -61,23 +64,11 @@ void loop() {
     }
   }
 
+  // Let the ArduinoPebbleSerial code do its processing - all of the requests are handled by the
+  // attribute handlers above
   uint16_t service_id;
   uint16_t attribute_id;
   size_t length;
   RequestType type;
-  if (ArduinoPebbleSerial::feed(&service_id, &attribute_id, &length, &type)) {
-    // process the request
-    if (service_id == SERVICE_ID) {
-      switch (attribute_id) {
-        case UPTIME_ATTRIBUTE_ID:
-          handle_uptime_request(type, length);
-          break;
-        case LED_ATTRIBUTE_ID:
-          handle_led_request(type, length);
-          break;
-        default:
-          break;
-      }
-    }
-  }
+  ArduinoPebbleSerial::feed(&service_id, &attribute_id, &length, &type);
 }
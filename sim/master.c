@@ -0,0 +1,144 @@
+#include "master.h"
+
+#include <string.h>
+
+#include "crc.h"
+#include "encoding.h"
+
+static size_t prv_encode_bytes(uint8_t *out, const uint8_t *data, size_t length,
+                               uint8_t *checksum) {
+  crc8_calculate_buffer(data, length, checksum);
+  size_t out_length = 0;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    uint8_t byte = data[i];
+    if (encoding_encode(&byte)) {
+      out[out_length++] = ENCODING_ESCAPE;
+    }
+    out[out_length++] = byte;
+  }
+  return out_length;
+}
+
+size_t master_encode_frame(uint8_t *out, bool is_read, SmartstrapProfile profile,
+                           const uint8_t *payload, size_t length) {
+  uint8_t header[FRAME_PAYLOAD_OFFSET] = { PROTOCOL_VERSION, 0, 0, 0, 0, profile, 0 };
+  header[FRAME_FLAGS_OFFSET] = FLAGS_IS_MASTER_MASK | (is_read ? FLAGS_IS_READ_MASK : 0);
+  uint8_t checksum = 0;
+  size_t out_length = 0;
+  out[out_length++] = ENCODING_FLAG;
+  out_length += prv_encode_bytes(&out[out_length], header, sizeof(header), &checksum);
+  out_length += prv_encode_bytes(&out[out_length], payload, length, &checksum);
+  // the checksum has to be encoded as well, which runs the CRC over it (but that's not used)
+  uint8_t footer = checksum;
+  out_length += prv_encode_bytes(&out[out_length], &footer, 1, &checksum);
+  out[out_length++] = ENCODING_FLAG;
+  return out_length;
+}
+
+size_t master_encode_link_control(uint8_t *out, LinkControlType type) {
+  const uint8_t payload[] = { PROTOCOL_VERSION, type };
+  return master_encode_frame(out, true, SmartstrapProfileLinkControl, payload, sizeof(payload));
+}
+
+size_t master_generic_payload(uint8_t *out, SmartstrapRequestType type, uint16_t service_id,
+                              uint16_t attribute_id, const uint8_t *data, uint16_t length) {
+  const GenericServicePayload header = {
+    .version = GENERIC_SERVICE_VERSION,
+    .service_id = service_id,
+    .attribute_id = attribute_id,
+    .type = type,
+    .error = 0,
+    .length = length
+  };
+  memcpy(out, &header, sizeof(header));
+  if (length) {
+    memcpy(&out[sizeof(header)], data, length);
+  }
+  return sizeof(header) + length;
+}
+
+void master_decoder_init(MasterDecoder *decoder) {
+  memset(decoder, 0, sizeof(*decoder));
+}
+
+static bool prv_is_break(const MasterDecoder *decoder) {
+  size_t i;
+  for (i = 0; i < decoder->raw_length; i++) {
+    if (decoder->raw[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool prv_finish_frame(MasterDecoder *decoder, MasterFrame *frame) {
+  if (decoder->raw_length == 0) {
+    // back-to-back flags
+    return false;
+  } else if (!decoder->is_invalid && prv_is_break(decoder)) {
+    decoder->num_breaks++;
+    return false;
+  }
+  uint8_t checksum = 0;
+  crc8_calculate_buffer(decoder->raw, decoder->raw_length, &checksum);
+  uint32_t flags;
+  memcpy(&flags, &decoder->raw[FRAME_FLAGS_OFFSET], sizeof(flags));
+  if (decoder->is_invalid || (decoder->raw_length < FRAME_MIN_LENGTH) || (checksum != 0) ||
+      (decoder->raw[FRAME_VERSION_OFFSET] != PROTOCOL_VERSION) ||
+      FLAGS_GET(flags, FLAGS_IS_MASTER_MASK, FLAGS_IS_MASTER_OFFSET)) {
+    decoder->num_bad_frames++;
+    return false;
+  }
+  frame->flags = flags;
+  frame->profile = decoder->raw[FRAME_PROFILE_OFFSET] |
+                   (decoder->raw[FRAME_PROFILE_OFFSET + 1] << 8);
+  frame->length = decoder->raw_length - FRAME_MIN_LENGTH;
+  memcpy(frame->payload, &decoder->raw[FRAME_PAYLOAD_OFFSET], frame->length);
+  return true;
+}
+
+bool master_decoder_feed(MasterDecoder *decoder, uint8_t data, MasterFrame *frame) {
+  if (data == ENCODING_FLAG) {
+    const bool is_complete = !decoder->escape && prv_finish_frame(decoder, frame);
+    if (decoder->escape) {
+      decoder->num_bad_frames++;
+    }
+    decoder->raw_length = 0;
+    decoder->escape = false;
+    decoder->is_invalid = false;
+    return is_complete;
+  } else if (decoder->is_invalid) {
+    return false;
+  } else if (data == ENCODING_ESCAPE) {
+    if (decoder->escape) {
+      decoder->is_invalid = true;
+    }
+    decoder->escape = true;
+    return false;
+  }
+  if (decoder->escape) {
+    data ^= ENCODING_ESCAPE_MASK;
+    decoder->escape = false;
+  }
+  if (decoder->raw_length == sizeof(decoder->raw)) {
+    decoder->is_invalid = true;
+    return false;
+  }
+  decoder->raw[decoder->raw_length++] = data;
+  return false;
+}
+
+bool master_parse_generic(const MasterFrame *frame, GenericServicePayload *header,
+                          const uint8_t **data) {
+  if ((frame->profile != SmartstrapProfileGenericService) || (frame->length < sizeof(*header))) {
+    return false;
+  }
+  memcpy(header, frame->payload, sizeof(*header));
+  if ((header->version != GENERIC_SERVICE_VERSION) ||
+      (header->length != frame->length - sizeof(*header))) {
+    return false;
+  }
+  *data = &frame->payload[sizeof(*header)];
+  return true;
+}
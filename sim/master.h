@@ -0,0 +1,59 @@
+#pragma once
+
+/*
+ * The watch (master) side of the smartstrap framing: encoding the frames which the watch sends and
+ * decoding the frames which the strap sends back. This is used by the simulator and the tests to
+ * talk to the library the same way a watch would.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PebbleSerial.h"
+#include "SmartstrapProtocol.h"
+
+#define MASTER_MAX_PAYLOAD_LENGTH 2048
+// the most bytes an encoded frame with the given payload length can take on the wire
+#define MASTER_MAX_FRAME_LENGTH(payload_length) (2 * (FRAME_MIN_LENGTH + (payload_length)) + 2)
+
+typedef struct {
+  uint32_t flags;
+  SmartstrapProfile profile;
+  uint8_t payload[MASTER_MAX_PAYLOAD_LENGTH];
+  size_t length;
+} MasterFrame;
+
+typedef struct {
+  uint8_t raw[FRAME_MIN_LENGTH + MASTER_MAX_PAYLOAD_LENGTH];
+  size_t raw_length;
+  bool escape;
+  bool is_invalid;
+  // runs of break bytes before a frame (which is how the strap wakes the watch for a notification)
+  uint32_t num_breaks;
+  // frames which failed to decode, had a bad checksum or weren't from a strap
+  uint32_t num_bad_frames;
+} MasterDecoder;
+
+// Encodes a frame into out, which must hold MASTER_MAX_FRAME_LENGTH(length) bytes, and returns the
+// number of bytes to send.
+size_t master_encode_frame(uint8_t *out, bool is_read, SmartstrapProfile profile,
+                           const uint8_t *payload, size_t length);
+size_t master_encode_link_control(uint8_t *out, LinkControlType type);
+// Builds the payload of a generic service request into out, which must hold
+// sizeof(GenericServicePayload) + length bytes, and returns its length. The frame is always sent as
+// a read since the strap responds to every type of request.
+size_t master_generic_payload(uint8_t *out, SmartstrapRequestType type, uint16_t service_id,
+                              uint16_t attribute_id, const uint8_t *data, uint16_t length);
+
+void master_decoder_init(MasterDecoder *decoder);
+// Decodes a byte from the strap and returns true once it completes a valid frame.
+bool master_decoder_feed(MasterDecoder *decoder, uint8_t data, MasterFrame *frame);
+
+static inline bool master_frame_is_notification(const MasterFrame *frame) {
+  return FLAGS_GET(frame->flags, FLAGS_IS_NOTIFICATION_MASK, FLAGS_IS_NOTIFICATION_OFFSET);
+}
+
+// Splits a generic service frame into its header and data. Returns false if it isn't valid.
+bool master_parse_generic(const MasterFrame *frame, GenericServicePayload *header,
+                          const uint8_t **data);
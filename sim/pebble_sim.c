@@ -0,0 +1,364 @@
+/*
+ * Runs the library against a simulated watch at each baud rate, and reports the requests per second
+ * and the latency of each type of generic service request as JSON lines. Every response is checked,
+ * so this exits with an error if anything goes wrong. The history reads return the same --length
+ * bytes of sensor history with pebble_ctx_write() and with pebble_ctx_write_compressed(), so the
+ * two show whether compression pays for itself at each baud rate. The value reads fetch the same
+ * NUM_VALUES value attributes one at a time and with one batch read, and each of their requests is
+ * a read of the whole set.
+ *
+ * Options:
+ *   --quick               run fewer requests (as a smoke test)
+ *   --notify-ms <ms>      have the strap send a notification this often (in simulated time)
+ *   --length <bytes>      the most data to send with a request (the lengths are random up to this)
+ *                         and the length of the history which is read
+ *   --strap-byte-ns <ns>  the time the strap takes to decode or encode a byte
+ *   --compress-byte-ns <ns>
+ *                         the time the strap takes to run the compressor over a byte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+#include "sim.h"
+
+#define NUM_REQUESTS        2000
+#define NUM_QUICK_REQUESTS  100
+#define DEFAULT_LENGTH      64
+// About 640 cycles at 16MHz. A position which doesn't match is compared against every byte in the
+// window (LZ_WINDOW_SIZE) at a few cycles each, and the positions inside a match are skipped.
+#define DEFAULT_COMPRESS_BYTE_NS  40000
+// the value attributes for the value reads, which are the size of a typical sensor reading
+#define NUM_VALUES          4
+#define VALUE_LENGTH        4
+#define VALUE_ATTRIBUTE_ID  0x0010
+
+typedef enum {
+  WorkloadRead,
+  WorkloadWrite,
+  WorkloadWriteRead,
+  WorkloadHistoryRead,
+  WorkloadCompressedHistoryRead,
+  WorkloadValueRead,
+  WorkloadBatchValueRead,
+  NumWorkloads
+} Workload;
+
+static const char *WORKLOAD_NAMES[NumWorkloads] = {
+  "generic_read", "generic_write", "generic_write_read", "history_read",
+  "history_read_compressed", "value_read", "value_read_batch"
+};
+
+typedef struct {
+  bool quick;
+  uint32_t notify_ms;
+  uint16_t length;
+  long strap_byte_ns;
+  long compress_byte_ns;
+} Options;
+
+// whether the history application compresses its responses, and what that costs per byte
+static bool s_compress_history;
+static uint32_t s_compress_byte_ns;
+
+static uint8_t s_values[NUM_VALUES][VALUE_LENGTH];
+// the value attributes and the batch read service, along with the attribute which the default
+// application handles (for the notifications)
+static PebbleAttribute s_value_attributes[NUM_VALUES + 2];
+
+static bool prv_parse_options(int argc, char **argv, Options *options) {
+  *options = (Options) {
+    .length = DEFAULT_LENGTH,
+    .strap_byte_ns = -1,
+    .compress_byte_ns = DEFAULT_COMPRESS_BYTE_NS
+  };
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      options->quick = true;
+    } else if ((strcmp(argv[i], "--notify-ms") == 0) && (i + 1 < argc)) {
+      options->notify_ms = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--length") == 0) && (i + 1 < argc)) {
+      options->length = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--strap-byte-ns") == 0) && (i + 1 < argc)) {
+      options->strap_byte_ns = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "--compress-byte-ns") == 0) && (i + 1 < argc)) {
+      options->compress_byte_ns = atol(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  return (options->length > 0) && (options->length <= SIM_MAX_DATA_LENGTH) &&
+         (options->compress_byte_ns >= 0);
+}
+
+// Fills in a log of 8 byte samples (a sensor ID and status, a temperature and humidity which drift
+// slowly, and a timestamp which goes up by a minute), which is the sort of value that compresses.
+static void prv_fill_history(uint8_t *data, size_t length) {
+  uint16_t timestamp = 0;
+  int16_t temperature = 215;
+  uint8_t humidity = 40;
+  uint32_t seed = 1;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    if (i % 8 == 0) {
+      timestamp += 60;
+      seed = seed * 1103515245 + 12345;
+      switch ((seed >> 16) % 8) {
+      case 0:
+        temperature++;
+        break;
+      case 1:
+        temperature--;
+        break;
+      case 2:
+        humidity++;
+        break;
+      }
+    }
+    const uint8_t sample[8] = { 0x01, 0x00, temperature, temperature >> 8, humidity, 0x00,
+                                timestamp, timestamp >> 8 };
+    data[i] = sample[i % 8];
+  }
+}
+
+static void prv_init_values(Sim *sim) {
+  // the library sorts the table, so it's filled in from scratch each time
+  const PebbleAttribute batch_attribute = PEBBLE_BATCH_READ_ATTRIBUTE(NUM_VALUES);
+  s_value_attributes[0] = batch_attribute;
+  s_value_attributes[1] = (PebbleAttribute) {
+    .service_id = SIM_SERVICE_ID,
+    .attribute_id = SIM_ATTRIBUTE_ID,
+    .max_length = SIM_MAX_DATA_LENGTH,
+    .request_types = SmartstrapRequestMaskRead | SmartstrapRequestMaskWrite |
+                     SmartstrapRequestMaskWriteRead
+  };
+  size_t i;
+  for (i = 0; i < NUM_VALUES; i++) {
+    sim_fill_pattern(s_values[i], VALUE_LENGTH, VALUE_ATTRIBUTE_ID + i);
+    s_value_attributes[2 + i] = (PebbleAttribute) {
+      .service_id = SIM_SERVICE_ID,
+      .attribute_id = VALUE_ATTRIBUTE_ID + i,
+      .max_length = VALUE_LENGTH,
+      .request_types = SmartstrapRequestMaskRead,
+      .value = s_values[i]
+    };
+  }
+  pebble_ctx_set_attributes(&sim->strap, s_value_attributes,
+                            sizeof(s_value_attributes) / sizeof(s_value_attributes[0]));
+}
+
+static bool prv_read_values(Sim *sim) {
+  MasterFrame response;
+  const uint8_t *response_data;
+  size_t response_length;
+  size_t i;
+  for (i = 0; i < NUM_VALUES; i++) {
+    if (!sim_generic(sim, SmartstrapRequestTypeRead, SIM_SERVICE_ID, VALUE_ATTRIBUTE_ID + i, NULL,
+                     0, &response, &response_data, &response_length) ||
+        (response_length != VALUE_LENGTH) ||
+        (memcmp(response_data, s_values[i], VALUE_LENGTH) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool prv_batch_read_values(Sim *sim) {
+  uint16_t request[NUM_VALUES][2];
+  size_t i;
+  for (i = 0; i < NUM_VALUES; i++) {
+    request[i][0] = SIM_SERVICE_ID;
+    request[i][1] = VALUE_ATTRIBUTE_ID + i;
+  }
+  MasterFrame response;
+  const uint8_t *response_data;
+  size_t response_length;
+  if (!sim_generic(sim, SmartstrapRequestTypeWriteRead, PEBBLE_BATCH_SERVICE_ID,
+                   PEBBLE_BATCH_READ_ATTRIBUTE_ID, (const uint8_t *)request, sizeof(request),
+                   &response, &response_data, &response_length) ||
+      (response_length != NUM_VALUES * (2 + VALUE_LENGTH))) {
+    return false;
+  }
+  for (i = 0; i < NUM_VALUES; i++) {
+    const uint8_t *item = &response_data[i * (2 + VALUE_LENGTH)];
+    if ((item[0] != PebbleBatchStatusOk) || (item[1] != VALUE_LENGTH) ||
+        (memcmp(&item[2], s_values[i], VALUE_LENGTH) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Answers reads of SIM_SERVICE_ID with read_length bytes of history, and handles everything else
+// the same way as the default application.
+static void prv_history_app_handler(Sim *sim, uint16_t service_id, uint16_t attribute_id,
+                                    SmartstrapRequestType type, uint8_t *data, size_t length) {
+  if ((service_id != SIM_SERVICE_ID) || (type != SmartstrapRequestTypeRead)) {
+    sim_default_app_handler(sim, service_id, attribute_id, type, data, length);
+    return;
+  }
+  uint8_t value[SIM_MAX_DATA_LENGTH];
+  prv_fill_history(value, sim->read_length);
+  if (!s_compress_history) {
+    pebble_ctx_write(&sim->strap, true, value, sim->read_length);
+    return;
+  }
+  // pebble_ctx_write_compressed() runs the compressor once for the length, and again as it sends
+  // unless the data doesn't compress. Neither pass overlaps with the bytes going out.
+  const size_t compressed_length = lz_compress(value, sim->read_length, NULL, NULL);
+  const uint32_t num_passes = (compressed_length < sim->read_length) ? 2 : 1;
+  sim->now_ns += (uint64_t)num_passes * sim->read_length * s_compress_byte_ns;
+  pebble_ctx_write_compressed(&sim->strap, true, value, sim->read_length);
+}
+
+static int prv_compare_u64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static double prv_percentile_us(const uint64_t *sorted, size_t count, int percentile) {
+  size_t index = (count * percentile + 99) / 100;
+  index = index ? (index - 1) : 0;
+  return sorted[index] / 1000.0;
+}
+
+static bool prv_request(Sim *sim, Workload workload, uint32_t *seed, uint16_t max_length) {
+  uint8_t data[SIM_MAX_DATA_LENGTH];
+  *seed = *seed * 1103515245 + 12345;
+  const uint16_t length = 1 + ((*seed >> 16) % max_length);
+  sim_fill_pattern(data, length, *seed);
+
+  MasterFrame response;
+  const uint8_t *response_data;
+  size_t response_length;
+  uint8_t expected[SIM_MAX_DATA_LENGTH];
+  uint8_t decompressed[SIM_MAX_DATA_LENGTH];
+  size_t decompressed_length;
+  switch (workload) {
+  case WorkloadRead:
+    sim_fill_pattern(expected, sim->read_length, SIM_ATTRIBUTE_ID);
+    return sim_generic(sim, SmartstrapRequestTypeRead, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID, NULL, 0,
+                       &response, &response_data, &response_length) &&
+           (response_length == sim->read_length) &&
+           (memcmp(response_data, expected, response_length) == 0);
+  case WorkloadWrite:
+    return sim_generic(sim, SmartstrapRequestTypeWrite, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID, data,
+                       length, &response, &response_data, &response_length) &&
+           (response_length == 0);
+  case WorkloadWriteRead:
+    return sim_generic(sim, SmartstrapRequestTypeWriteRead, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID,
+                       data, length, &response, &response_data, &response_length) &&
+           (response_length == length) && (memcmp(response_data, data, length) == 0);
+  case WorkloadHistoryRead:
+    prv_fill_history(expected, sim->read_length);
+    return sim_generic(sim, SmartstrapRequestTypeRead, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID, NULL, 0,
+                       &response, &response_data, &response_length) &&
+           (response_length == sim->read_length) &&
+           (memcmp(response_data, expected, response_length) == 0);
+  case WorkloadCompressedHistoryRead:
+    prv_fill_history(expected, sim->read_length);
+    return sim_generic(sim, SmartstrapRequestTypeRead, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID, NULL, 0,
+                       &response, &response_data, &response_length) &&
+           lz_decompress(response_data, response_length, decompressed, sizeof(decompressed),
+                         &decompressed_length) &&
+           (decompressed_length == sim->read_length) &&
+           (memcmp(decompressed, expected, decompressed_length) == 0);
+  case WorkloadValueRead:
+    return prv_read_values(sim);
+  case WorkloadBatchValueRead:
+    return prv_batch_read_values(sim);
+  default:
+    return false;
+  }
+}
+
+static bool prv_run(PebbleBaud baud, Workload workload, const Options *options) {
+  static uint64_t latencies[NUM_REQUESTS];
+  const size_t num_requests = options->quick ? NUM_QUICK_REQUESTS : NUM_REQUESTS;
+  Sim sim;
+  if (!sim_init(&sim, baud)) {
+    perror("socketpair");
+    return false;
+  }
+  if (options->strap_byte_ns >= 0) {
+    sim.strap_byte_ns = options->strap_byte_ns;
+  }
+  if ((workload == WorkloadHistoryRead) || (workload == WorkloadCompressedHistoryRead)) {
+    sim.app_handler = prv_history_app_handler;
+    sim.read_length = options->length;
+    s_compress_history = (workload == WorkloadCompressedHistoryRead);
+    s_compress_byte_ns = options->compress_byte_ns;
+  } else if ((workload == WorkloadValueRead) || (workload == WorkloadBatchValueRead)) {
+    prv_init_values(&sim);
+  }
+  const bool is_connected = sim_connect(&sim);
+  // the bytes sent for the requests themselves (rather than for notifications)
+  uint64_t bytes_to_strap = 0;
+  uint64_t bytes_to_watch = 0;
+  const uint64_t start_ns = sim.now_ns;
+  uint64_t next_notify_ns = start_ns + (uint64_t)options->notify_ms * 1000000;
+  uint32_t seed = baud * NumWorkloads + workload;
+  uint32_t num_failed = 0;
+  size_t i;
+  for (i = 0; is_connected && (i < num_requests); i++) {
+    if (options->notify_ms && (sim.now_ns >= next_notify_ns)) {
+      // the strap application has something new for the watch
+      pebble_ctx_notify(&sim.strap, SIM_SERVICE_ID, SIM_ATTRIBUTE_ID, sim.now_ns / 1000000);
+      next_notify_ns += (uint64_t)options->notify_ms * 1000000;
+    }
+    sim_idle(&sim, 0);
+    const SimStats request_start_stats = sim.stats;
+    const uint64_t request_start_ns = sim.now_ns;
+    if (!prv_request(&sim, workload, &seed, options->length)) {
+      num_failed++;
+    }
+    latencies[i] = sim.now_ns - request_start_ns;
+    bytes_to_strap += sim.stats.bytes_to_strap - request_start_stats.bytes_to_strap;
+    bytes_to_watch += sim.stats.bytes_to_watch - request_start_stats.bytes_to_watch;
+  }
+  sim_idle(&sim, 0);
+  const uint64_t elapsed_ns = sim.now_ns - start_ns;
+  const uint32_t num_errors = sim.stats.errors + num_failed;
+  sim_deinit(&sim);
+
+  printf("{\"baud\":%lu,\"request\":\"%s\",\"connected\":%s", (unsigned long)sim_baud_rate(baud),
+         WORKLOAD_NAMES[workload], is_connected ? "true" : "false");
+  if (is_connected) {
+    qsort(latencies, num_requests, sizeof(latencies[0]), prv_compare_u64);
+    printf(",\"requests\":%lu,\"requests_per_sec\":%.1f,\"latency_us_p50\":%.1f,"
+           "\"latency_us_p90\":%.1f,\"latency_us_p99\":%.1f,\"latency_us_max\":%.1f,"
+           "\"bytes_to_strap_per_request\":%.1f,\"bytes_to_watch_per_request\":%.1f,"
+           "\"notifications\":%lu", (unsigned long)num_requests,
+           num_requests * 1e9 / elapsed_ns, prv_percentile_us(latencies, num_requests, 50),
+           prv_percentile_us(latencies, num_requests, 90),
+           prv_percentile_us(latencies, num_requests, 99),
+           latencies[num_requests - 1] / 1000.0,
+           (double)bytes_to_strap / num_requests, (double)bytes_to_watch / num_requests,
+           (unsigned long)sim.stats.notifications);
+  }
+  printf(",\"errors\":%lu}\n", (unsigned long)num_errors);
+  fflush(stdout);
+  return is_connected && (num_errors == 0);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!prv_parse_options(argc, argv, &options)) {
+    fprintf(stderr, "usage: %s [--quick] [--notify-ms <ms>] [--length <bytes>] "
+            "[--strap-byte-ns <ns>] [--compress-byte-ns <ns>]\n", argv[0]);
+    return 2;
+  }
+  bool success = true;
+  int baud;
+  for (baud = 0; baud < PebbleBaudInvalid; baud++) {
+    int workload;
+    for (workload = 0; workload < NumWorkloads; workload++) {
+      success &= prv_run(baud, workload, &options);
+    }
+  }
+  return success ? 0 : 1;
+}
@@ -0,0 +1,357 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// a start bit, 8 data bits and a stop bit
+#define BITS_PER_BYTE         10
+// how far apart the two ends' baud rates can be before bytes are corrupted (in percent)
+#define MAX_BAUD_ERROR        3
+#define DEFAULT_READ_LENGTH   16
+#define DEFAULT_STRAP_BYTE_NS 5000
+
+static const uint32_t BAUD_RATES[] = { 9600, 14400, 19200, 28800, 38400, 57600, 62500, 115200,
+                                       125000, 230400, 250000, 460800 };
+static const uint16_t SERVICES[] = { 0x0000, SIM_SERVICE_ID };
+
+uint32_t sim_baud_rate(PebbleBaud baud) {
+  return (baud < PebbleBaudInvalid) ? BAUD_RATES[baud] : 0;
+}
+
+static inline uint64_t prv_wire_ns(size_t length, uint32_t bps) {
+  return (uint64_t)length * BITS_PER_BYTE * 1000000000 / bps;
+}
+
+static bool prv_rates_match(const Sim *sim) {
+  const uint32_t difference = (sim->strap_bps > sim->watch_bps) ?
+                              (sim->strap_bps - sim->watch_bps) :
+                              (sim->watch_bps - sim->strap_bps);
+  return difference * 100 <= (uint64_t)sim->watch_bps * MAX_BAUD_ERROR;
+}
+
+static void prv_send(Sim *sim, int fd, const uint8_t *data, size_t length) {
+  uint8_t corrupted[SIM_TX_BUFFER_SIZE];
+  const bool is_corrupted = !prv_rates_match(sim);
+  while (length) {
+    size_t chunk = length;
+    if (is_corrupted) {
+      // the receiver samples the bits in the wrong places
+      chunk = (length < sizeof(corrupted)) ? length : sizeof(corrupted);
+      size_t i;
+      for (i = 0; i < chunk; i++) {
+        corrupted[i] = data[i] ^ 0x5A;
+      }
+    }
+    const ssize_t written = write(fd, is_corrupted ? corrupted : data, chunk);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sim->stats.errors++;
+      return;
+    }
+    data += written;
+    length -= written;
+  }
+}
+
+// Strap side
+////////////////////////////////////////////////////////////////////////////////
+
+static void prv_strap_send(Sim *sim, const uint8_t *data, size_t length) {
+  prv_send(sim, sim->fds[0], data, length);
+  sim->stats.bytes_to_watch += length;
+  // a blocking transport waits for each byte to go out, and encodes the next one meanwhile
+  const uint64_t wire_ns = prv_wire_ns(1, sim->strap_bps);
+  sim->now_ns += length * ((wire_ns > sim->strap_byte_ns) ? wire_ns : sim->strap_byte_ns);
+}
+
+static void prv_strap_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  Sim *sim = context;
+  const uint8_t break_byte = 0x00;
+  switch (cmd) {
+  case SmartstrapCmdSetBaudRate:
+    sim->strap_bps = arg;
+    break;
+  case SmartstrapCmdSetTxEnabled:
+    break;
+  case SmartstrapCmdWriteByte: {
+    const uint8_t data = arg;
+    prv_strap_send(sim, &data, 1);
+    break;
+  }
+  case SmartstrapCmdWriteBreak:
+    // a break looks like a 0x00 byte with a missing stop bit to the watch
+    prv_strap_send(sim, &break_byte, 1);
+    break;
+  case SmartstrapCmdWriteBuffer:
+  case SmartstrapCmdWriteBufferAsync:
+    prv_strap_send(sim, sim->tx_buffer, arg);
+    if (cmd == SmartstrapCmdWriteBufferAsync) {
+      pebble_ctx_tx_complete(&sim->strap);
+    }
+    break;
+  }
+}
+
+static inline uint32_t prv_strap_time_ms(const Sim *sim) {
+  return sim->now_ns / 1000000;
+}
+
+static void prv_strap_handle_bytes(Sim *sim, const uint8_t *data, size_t length) {
+  // the bytes are decoded as they arrive, so the strap only falls behind if it's slower than the
+  // line, and otherwise just has the last byte left to decode
+  const uint64_t wire_ns = prv_wire_ns(1, sim->strap_bps);
+  if (sim->strap_byte_ns > wire_ns) {
+    sim->now_ns += length * (sim->strap_byte_ns - wire_ns);
+  }
+  sim->now_ns += sim->strap_byte_ns;
+
+  size_t offset = 0;
+  while (offset < length) {
+    size_t consumed;
+    uint16_t service_id;
+    uint16_t attribute_id;
+    size_t payload_length;
+    SmartstrapRequestType type;
+    if (pebble_ctx_handle_bytes(&sim->strap, &data[offset], length - offset, &consumed,
+                                &service_id, &attribute_id, &payload_length, &type,
+                                prv_strap_time_ms(sim))) {
+      // the buffers are filled in the order they were handed over
+      uint8_t *payload = sim->rx_buffers[sim->next_rx_buffer];
+      sim->app_handler(sim, service_id, attribute_id, type, payload, payload_length);
+      pebble_ctx_prepare_for_read(&sim->strap, payload, SIM_BUFFER_SIZE);
+      sim->next_rx_buffer ^= 1;
+    }
+    offset += consumed;
+  }
+}
+
+static void prv_strap_run(Sim *sim) {
+  uint8_t data[MASTER_MAX_FRAME_LENGTH(SIM_BUFFER_SIZE)];
+  ssize_t length = read(sim->fds[0], data, sizeof(data));
+  if (length <= 0) {
+    // nothing to receive, but the strap may have notifications to send
+    pebble_ctx_is_connected(&sim->strap, prv_strap_time_ms(sim));
+    return;
+  }
+  do {
+    prv_strap_handle_bytes(sim, data, length);
+  } while ((length = read(sim->fds[0], data, sizeof(data))) > 0);
+}
+
+void sim_fill_pattern(uint8_t *data, size_t length, uint32_t seed) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+}
+
+void sim_default_app_handler(Sim *sim, uint16_t service_id, uint16_t attribute_id,
+                             SmartstrapRequestType type, uint8_t *data, size_t length) {
+  if ((service_id != 0x0000) && (service_id != SIM_SERVICE_ID)) {
+    pebble_ctx_write(&sim->strap, false, NULL, 0);
+  } else if (type == SmartstrapRequestTypeRead) {
+    uint8_t value[SIM_MAX_DATA_LENGTH];
+    const uint16_t value_length = (sim->read_length < sizeof(value)) ? sim->read_length :
+                                                                        sizeof(value);
+    sim_fill_pattern(value, value_length, attribute_id);
+    pebble_ctx_write(&sim->strap, true, value, value_length);
+  } else if (type == SmartstrapRequestTypeWriteRead) {
+    pebble_ctx_write(&sim->strap, true, data, length);
+  } else if (service_id != 0x0000) {
+    // acknowledge the write (raw data writes don't get a response)
+    pebble_ctx_write(&sim->strap, true, NULL, 0);
+  }
+}
+
+// Watch side
+////////////////////////////////////////////////////////////////////////////////
+
+bool sim_init(Sim *sim, PebbleBaud baud) {
+  memset(sim, 0, sizeof(*sim));
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sim->fds) != 0) {
+    return false;
+  }
+  int i;
+  for (i = 0; i < 2; i++) {
+    fcntl(sim->fds[i], F_SETFL, fcntl(sim->fds[i], F_GETFL) | O_NONBLOCK);
+  }
+  sim->baud = baud;
+  sim->watch_bps = sim_baud_rate(PebbleBaud9600);
+  sim->strap_byte_ns = DEFAULT_STRAP_BYTE_NS;
+  sim->app_handler = sim_default_app_handler;
+  sim->read_length = DEFAULT_READ_LENGTH;
+  master_decoder_init(&sim->decoder);
+
+  pebble_ctx_init(&sim->strap, prv_strap_callback, sim, baud, SERVICES,
+                  sizeof(SERVICES) / sizeof(SERVICES[0]));
+  pebble_ctx_set_tx_buffer(&sim->strap, sim->tx_buffer, sizeof(sim->tx_buffer));
+  pebble_ctx_prepare_for_read(&sim->strap, sim->rx_buffers[0], SIM_BUFFER_SIZE);
+  pebble_ctx_prepare_for_read(&sim->strap, sim->rx_buffers[1], SIM_BUFFER_SIZE);
+  return true;
+}
+
+void sim_deinit(Sim *sim) {
+  close(sim->fds[0]);
+  close(sim->fds[1]);
+}
+
+static void prv_watch_send(Sim *sim, const uint8_t *data, size_t length) {
+  prv_send(sim, sim->fds[1], data, length);
+  sim->stats.bytes_to_strap += length;
+  sim->now_ns += prv_wire_ns(length, sim->watch_bps);
+}
+
+// Reads bytes from the strap until there's a frame, leaving the rest for next time.
+static bool prv_watch_receive(Sim *sim, MasterFrame *frame) {
+  uint8_t data;
+  while (read(sim->fds[1], &data, 1) == 1) {
+    if (master_decoder_feed(&sim->decoder, data, frame)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool prv_handle_notification(Sim *sim, const MasterFrame *notification) {
+  sim->stats.notifications++;
+  if (notification->profile == SmartstrapProfileRawData) {
+    // there's no notification info for raw data, so just read it
+    MasterFrame response;
+    return sim_transfer(sim, true, SmartstrapProfileRawData, NULL, 0, &response);
+  }
+  MasterFrame response;
+  const uint8_t *data;
+  size_t length;
+  if (!sim_generic(sim, SmartstrapRequestTypeRead, MANAGEMENT_SERVICE_ID,
+                   MANAGEMENT_NOTIFICATION_INFO_ATTRIBUTE, NULL, 0, &response, &data, &length) ||
+      (length != 2 * sizeof(uint16_t))) {
+    return false;
+  }
+  uint16_t info[2];
+  memcpy(info, data, sizeof(info));
+  return sim_generic(sim, SmartstrapRequestTypeRead, info[0], info[1], NULL, 0, &response, &data,
+                     &length);
+}
+
+// Handles the notifications which have arrived at the watch. The requests for them are sent after
+// the notification frame, so a notification which arrives while one is being handled is picked
+// up by the same loop.
+static uint32_t prv_handle_notifications(Sim *sim) {
+  uint32_t count = 0;
+  MasterFrame frame;
+  while (prv_watch_receive(sim, &frame)) {
+    if (!master_frame_is_notification(&frame)) {
+      // the strap sent a response which nothing asked for
+      sim->stats.errors++;
+      continue;
+    }
+    count++;
+    if (!prv_handle_notification(sim, &frame)) {
+      sim->stats.errors++;
+    }
+  }
+  return count;
+}
+
+uint32_t sim_idle(Sim *sim, uint64_t duration_ns) {
+  sim->now_ns += duration_ns;
+  prv_strap_run(sim);
+  return prv_handle_notifications(sim);
+}
+
+bool sim_transfer(Sim *sim, bool is_read, SmartstrapProfile profile, const uint8_t *payload,
+                  size_t length, MasterFrame *response) {
+  uint8_t frame[MASTER_MAX_FRAME_LENGTH(FRAME_MIN_LENGTH + MASTER_MAX_PAYLOAD_LENGTH)];
+  sim->stats.requests++;
+  prv_watch_send(sim, frame, master_encode_frame(frame, is_read, profile, payload, length));
+  prv_strap_run(sim);
+  if (!is_read) {
+    return true;
+  }
+  // a notification can only be sent while the strap is idle, so the response comes first
+  bool has_response = false;
+  while (!has_response && prv_watch_receive(sim, response)) {
+    has_response = !master_frame_is_notification(response);
+  }
+  if (!has_response) {
+    sim->now_ns += (uint64_t)SIM_RESPONSE_TIMEOUT_MS * 1000000;
+    sim->stats.errors++;
+  }
+  return has_response;
+}
+
+bool sim_link_control(Sim *sim, LinkControlType type, MasterFrame *response) {
+  const uint8_t payload[] = { PROTOCOL_VERSION, type };
+  if (!sim_transfer(sim, true, SmartstrapProfileLinkControl, payload, sizeof(payload),
+                    response)) {
+    return false;
+  }
+  return (response->profile == SmartstrapProfileLinkControl) && (response->length >= 2) &&
+         (response->payload[1] == type);
+}
+
+bool sim_generic(Sim *sim, SmartstrapRequestType type, uint16_t service_id, uint16_t attribute_id,
+                 const uint8_t *data, uint16_t length, MasterFrame *response,
+                 const uint8_t **response_data, size_t *response_length) {
+  uint8_t payload[sizeof(GenericServicePayload) + MASTER_MAX_PAYLOAD_LENGTH];
+  const size_t payload_length = master_generic_payload(payload, type, service_id, attribute_id,
+                                                       data, length);
+  GenericServicePayload response_header;
+  if (!sim_transfer(sim, true, SmartstrapProfileGenericService, payload, payload_length,
+                    response) ||
+      !master_parse_generic(response, &response_header, response_data) ||
+      (response_header.service_id != service_id) ||
+      (response_header.attribute_id != attribute_id) || (response_header.error != 0)) {
+    return false;
+  }
+  *response_length = response_header.length;
+  return true;
+}
+
+bool sim_connect(Sim *sim) {
+  MasterFrame response;
+  if (!sim_link_control(sim, LinkControlTypeStatus, &response) || (response.length != 3)) {
+    return false;
+  }
+  if (response.payload[2] == LinkControlStatusBaudRate) {
+    if (!sim_link_control(sim, LinkControlTypeBaud, &response) || (response.length != 3) ||
+        (response.payload[2] >= PebbleBaudInvalid)) {
+      return false;
+    }
+    sim->watch_bps = sim_baud_rate(response.payload[2]);
+    if (!sim_link_control(sim, LinkControlTypeStatus, &response) || (response.length != 3)) {
+      return false;
+    }
+  }
+  if (response.payload[2] != LinkControlStatusOk) {
+    return false;
+  }
+
+  if (!sim_link_control(sim, LinkControlTypeProfiles, &response)) {
+    return false;
+  }
+  bool has_generic_profile = false;
+  size_t i;
+  for (i = 2; i + sizeof(uint16_t) <= response.length; i += sizeof(uint16_t)) {
+    uint16_t profile;
+    memcpy(&profile, &response.payload[i], sizeof(profile));
+    has_generic_profile |= (profile == SmartstrapProfileGenericService);
+  }
+  if (!has_generic_profile) {
+    return false;
+  }
+
+  const uint8_t *services;
+  size_t length;
+  return sim_generic(sim, SmartstrapRequestTypeRead, MANAGEMENT_SERVICE_ID,
+                     MANAGEMENT_SERVICE_DISCOVERY_ATTRIBUTE, NULL, 0, &response, &services,
+                     &length) && (length > 0);
+}
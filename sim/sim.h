@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ * A simulated link between a watch and a strap running the library. The two ends talk over a
+ * socketpair, but time is virtual: it moves on by the time each byte takes on the wire at the baud
+ * rate it's sent at, plus a modelled cost for the strap to handle each byte, so the results don't
+ * depend on how fast (or how busy) the host is. Bytes sent while the two ends disagree on the baud
+ * rate arrive corrupted, as they would on a real line.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "master.h"
+#include "PebbleSerial.h"
+
+#define SIM_MAX_DATA_LENGTH       256
+#define SIM_BUFFER_SIZE           GET_PAYLOAD_BUFFER_SIZE(SIM_MAX_DATA_LENGTH)
+#define SIM_TX_BUFFER_SIZE        32
+// how long the watch waits for a response before giving up on a request
+#define SIM_RESPONSE_TIMEOUT_MS   100
+// the service which the default strap application answers requests for
+#define SIM_SERVICE_ID            0x1001
+#define SIM_ATTRIBUTE_ID          0x0001
+
+typedef struct Sim Sim;
+
+// Handles a frame which the library returned to the strap application, and sends the response.
+typedef void (*SimAppHandler)(Sim *sim, uint16_t service_id, uint16_t attribute_id,
+                              SmartstrapRequestType type, uint8_t *data, size_t length);
+
+typedef struct {
+  uint64_t bytes_to_strap;
+  uint64_t bytes_to_watch;
+  uint32_t requests;
+  uint32_t notifications;
+  uint32_t errors;
+} SimStats;
+
+struct Sim {
+  // fds[0] is the strap's end and fds[1] is the watch's
+  int fds[2];
+  uint64_t now_ns;
+  // the cost for the strap to decode or encode a byte, which overlaps with the byte being sent
+  uint32_t strap_byte_ns;
+  uint32_t strap_bps;
+  uint32_t watch_bps;
+  PebbleBaud baud;
+
+  PebbleSerialContext strap;
+  uint8_t rx_buffers[2][SIM_BUFFER_SIZE];
+  uint8_t next_rx_buffer;
+  uint8_t tx_buffer[SIM_TX_BUFFER_SIZE];
+  SimAppHandler app_handler;
+  // the length of the responses to reads from the default strap application
+  uint16_t read_length;
+
+  MasterDecoder decoder;
+  SimStats stats;
+};
+
+// Sets up a strap which will ask to run at the given baud rate. The strap answers requests for
+// SIM_SERVICE_ID (and raw data) with the default application unless app_handler is changed.
+bool sim_init(Sim *sim, PebbleBaud baud);
+void sim_deinit(Sim *sim);
+
+// The nominal rate of a PebbleBaud, which is what the watch runs at.
+uint32_t sim_baud_rate(PebbleBaud baud);
+
+// Connects the same way the watch does: checks the link status, switches to the strap's baud rate,
+// reads the supported profiles and then discovers the services.
+bool sim_connect(Sim *sim);
+
+// Lets the strap run while the watch is idle, and handles any notifications it sends by reading
+// the notification info and then the attribute it's for. Returns the number of notifications.
+uint32_t sim_idle(Sim *sim, uint64_t duration_ns);
+
+// Sends a frame from the watch and waits for the response, handling any notifications which
+// arrive first. Returns false if there was no valid response.
+bool sim_transfer(Sim *sim, bool is_read, SmartstrapProfile profile, const uint8_t *payload,
+                  size_t length, MasterFrame *response);
+bool sim_link_control(Sim *sim, LinkControlType type, MasterFrame *response);
+// Sends a generic service request and returns the data of the response (which points into
+// response). Returns false if there was no response or it reported an error.
+bool sim_generic(Sim *sim, SmartstrapRequestType type, uint16_t service_id, uint16_t attribute_id,
+                 const uint8_t *data, uint16_t length, MasterFrame *response,
+                 const uint8_t **response_data, size_t *response_length);
+
+// The strap's default application, which answers reads with read_length bytes of a pattern
+// (sim_fill_pattern()), acknowledges writes and echoes the data of a WriteRead.
+void sim_default_app_handler(Sim *sim, uint16_t service_id, uint16_t attribute_id,
+                             SmartstrapRequestType type, uint8_t *data, size_t length);
+void sim_fill_pattern(uint8_t *data, size_t length, uint32_t seed);
@@ -0,0 +1,122 @@
+/*
+ * Checks that a value attribute guarded by a sequence number is only accepted along with payload
+ * buffers which are long enough to copy it into, whichever order the table and buffers are handed
+ * over in, and that such a value is then read back as it is.
+ */
+
+#include <string.h>
+
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define VALUE_LENGTH    16
+#define SERVICE_ID      0x1001
+#define ATTRIBUTE_ID    0x0001
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[VALUE_LENGTH];
+  uint8_t short_payload[VALUE_LENGTH - 1];
+  PebbleAttribute attributes[1];
+  uint8_t value[VALUE_LENGTH];
+  volatile uint8_t sequence;
+  MasterDecoder decoder;
+  MasterFrame response;
+  bool has_response;
+} AttributeTest;
+
+static AttributeTest s_test;
+
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  AttributeTest *test = context;
+  if ((cmd == SmartstrapCmdWriteByte) &&
+      master_decoder_feed(&test->decoder, arg, &test->response)) {
+    test->has_response = true;
+  }
+}
+
+static void prv_init(void) {
+  static const uint16_t SERVICES[] = { 0x0000, SERVICE_ID };
+  AttributeTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 2);
+  master_decoder_init(&test->decoder);
+  size_t i;
+  for (i = 0; i < VALUE_LENGTH; i++) {
+    test->value[i] = i * 3;
+  }
+  test->attributes[0] = (PebbleAttribute) {
+    .service_id = SERVICE_ID,
+    .attribute_id = ATTRIBUTE_ID,
+    .max_length = VALUE_LENGTH,
+    .request_types = SmartstrapRequestMaskRead,
+    .value = test->value,
+    .sequence = &test->sequence
+  };
+}
+
+static void prv_test_buffer_lengths(void) {
+  AttributeTest *test = &s_test;
+
+  // the table can't go in with a buffer which is too short
+  prv_init();
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->short_payload,
+                                          sizeof(test->short_payload)));
+  TEST_ASSERT(!pebble_ctx_set_attributes(&test->ctx, test->attributes, 1));
+
+  // and a queued buffer counts as well as the current one
+  prv_init();
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload)));
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->short_payload,
+                                          sizeof(test->short_payload)));
+  TEST_ASSERT(!pebble_ctx_set_attributes(&test->ctx, test->attributes, 1));
+
+  // once the table is in, a buffer which is too short for it is refused
+  prv_init();
+  TEST_ASSERT(pebble_ctx_set_attributes(&test->ctx, test->attributes, 1));
+  TEST_ASSERT(!pebble_ctx_prepare_for_read(&test->ctx, test->short_payload,
+                                           sizeof(test->short_payload)));
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload)));
+
+  // a value without a sequence number is sent from where it is, so any buffer will do
+  prv_init();
+  test->attributes[0].sequence = NULL;
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->short_payload,
+                                          sizeof(test->short_payload)));
+  TEST_ASSERT(pebble_ctx_set_attributes(&test->ctx, test->attributes, 1));
+}
+
+static void prv_test_guarded_read(void) {
+  static uint8_t payload[sizeof(GenericServicePayload)];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(sizeof(payload))];
+  AttributeTest *test = &s_test;
+  prv_init();
+  TEST_ASSERT(pebble_ctx_set_attributes(&test->ctx, test->attributes, 1));
+  TEST_ASSERT(pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload)));
+
+  const size_t payload_length = master_generic_payload(payload, SmartstrapRequestTypeRead,
+                                                       SERVICE_ID, ATTRIBUTE_ID, NULL, 0);
+  const size_t frame_length = master_encode_frame(frame, true, SmartstrapProfileGenericService,
+                                                  payload, payload_length);
+  size_t consumed;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  TEST_ASSERT(!pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                       &attribute_id, &length, &type, 0));
+  TEST_ASSERT(test->has_response);
+  GenericServicePayload header;
+  const uint8_t *data;
+  TEST_ASSERT(master_parse_generic(&test->response, &header, &data));
+  TEST_ASSERT_EQUAL(0, header.error);
+  TEST_ASSERT_EQUAL(VALUE_LENGTH, header.length);
+  TEST_ASSERT(memcmp(data, test->value, VALUE_LENGTH) == 0);
+}
+
+int main(void) {
+  prv_test_buffer_lengths();
+  prv_test_guarded_read();
+  return test_result();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Just enough of the AVR Arduino core for OneWireSoftSerial.cpp to build on a host, for
+ * soft_serial_test.cpp. Every pin is on port B with a pin change interrupt, the registers are
+ * plain variables supplied by the test, and the delay loops don't wait.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+
+#define F_CPU 16000000UL
+#define GCC_VERSION 40902
+
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+
+#define _BV(bit) (1 << (bit))
+#define bitSet(value, bit) ((value) |= _BV(bit))
+#define bitClear(value, bit) ((value) &= ~_BV(bit))
+
+extern volatile uint8_t PINB;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCMSK0;
+
+#define digitalPinToBitMask(pin) _BV((pin) & 7)
+#define digitalPinToPort(pin) 2
+#define portOutputRegister(port) (&PORTB)
+#define portInputRegister(port) (&PINB)
+#define digitalPinToPCICR(pin) (&PCICR)
+#define digitalPinToPCICRbit(pin) 0
+#define digitalPinToPCMSK(pin) (&PCMSK0)
+#define digitalPinToPCMSKbit(pin) ((pin) & 7)
+
+static inline void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+static inline void digitalWrite(uint8_t pin, uint8_t value) {
+  (void)pin;
+  (void)value;
+}
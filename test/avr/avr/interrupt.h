@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// the vector for the pins on port B, which soft_serial_test.cpp can call to deliver an edge
+#define PCINT0_vect pcint0_vect
+#define ISR(vector, ...) extern "C" void vector(void); void vector(void)
+#define ISR_ALIASOF(vector)
+
+extern volatile uint8_t SREG;
+
+static inline void cli(void) {
+}
+
+static inline void sei(void) {
+}
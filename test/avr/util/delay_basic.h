@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+static inline void _delay_loop_2(uint16_t count) {
+  (void)count;
+}
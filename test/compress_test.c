@@ -0,0 +1,109 @@
+/*
+ * Checks that pebble_ctx_write_compressed() sends a response which lz_decompress() turns back into
+ * the data, and that data too long to fit in a response along with its format byte is refused
+ * without anything being sent.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define BUFFER_LENGTH   32
+#define DATA_LENGTH     200
+#define SERVICE_ID      0x1001
+#define ATTRIBUTE_ID    0x0001
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[GET_PAYLOAD_BUFFER_SIZE(BUFFER_LENGTH)];
+  MasterDecoder decoder;
+  MasterFrame response;
+  bool has_response;
+  uint32_t num_bytes;
+} CompressTest;
+
+static CompressTest s_test;
+
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  CompressTest *test = context;
+  if (cmd == SmartstrapCmdWriteByte) {
+    test->num_bytes++;
+    if (master_decoder_feed(&test->decoder, arg, &test->response)) {
+      test->has_response = true;
+    }
+  }
+}
+
+// Sets up a new context which has received a read for the attribute and is waiting to respond.
+static void prv_init(void) {
+  static const uint16_t SERVICES[] = { 0x0000, SERVICE_ID };
+  static uint8_t payload[sizeof(GenericServicePayload)];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(sizeof(payload))];
+  CompressTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 2);
+  pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload));
+  master_decoder_init(&test->decoder);
+
+  const size_t payload_length = master_generic_payload(payload, SmartstrapRequestTypeRead,
+                                                       SERVICE_ID, ATTRIBUTE_ID, NULL, 0);
+  const size_t frame_length = master_encode_frame(frame, true, SmartstrapProfileGenericService,
+                                                  payload, payload_length);
+  size_t consumed;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  TEST_ASSERT(pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                      &attribute_id, &length, &type, 0));
+}
+
+static void prv_test_round_trip(void) {
+  static uint8_t data[DATA_LENGTH];
+  static uint8_t output[DATA_LENGTH];
+  CompressTest *test = &s_test;
+  size_t i;
+  for (i = 0; i < sizeof(data); i++) {
+    data[i] = i % 10;
+  }
+  prv_init();
+  TEST_ASSERT(pebble_ctx_write_compressed(&test->ctx, true, data, sizeof(data)));
+  TEST_ASSERT(test->has_response);
+  GenericServicePayload header;
+  const uint8_t *response_data;
+  TEST_ASSERT(master_parse_generic(&test->response, &header, &response_data));
+  TEST_ASSERT_EQUAL(LZ_FORMAT_COMPRESSED, response_data[0]);
+  TEST_ASSERT(header.length < sizeof(data));
+  size_t output_length;
+  TEST_ASSERT(lz_decompress(response_data, header.length, output, sizeof(output), &output_length));
+  TEST_ASSERT_EQUAL(sizeof(data), output_length);
+  TEST_ASSERT(memcmp(output, data, sizeof(data)) == 0);
+}
+
+static void prv_test_too_long(void) {
+  static uint8_t data[UINT16_MAX];
+  CompressTest *test = &s_test;
+  // data which doesn't compress is sent as it is, so the format byte takes the length past 16 bits
+  uint32_t seed = 1;
+  size_t i;
+  for (i = 0; i < sizeof(data); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 24;
+  }
+  prv_init();
+  TEST_ASSERT(!pebble_ctx_write_compressed(&test->ctx, true, data, sizeof(data)));
+  TEST_ASSERT_EQUAL(0, test->num_bytes);
+
+  // and the request can still be responded to
+  TEST_ASSERT(pebble_ctx_write(&test->ctx, false, NULL, 0));
+  TEST_ASSERT(test->has_response);
+}
+
+int main(void) {
+  prv_test_round_trip();
+  prv_test_too_long();
+  return test_result();
+}
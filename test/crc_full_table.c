@@ -0,0 +1,6 @@
+#include "crc_variants.h"
+
+#define CRC8_USE_FULL_TABLE 1
+#define crc8_calculate_byte_streaming crc8_full_table_byte_streaming
+#define crc8_calculate_buffer crc8_full_table_buffer
+#include "crc.c"
@@ -0,0 +1,86 @@
+/*
+ * Checks that crc.c gives the same CRCs with and without CRC8_USE_FULL_TABLE, and that both match
+ * a bit at a time implementation of the polynomial.
+ */
+
+#include <string.h>
+
+#include "crc.h"
+#include "crc_variants.h"
+#include "test.h"
+
+// x^8 + x^5 + x^3 + x^2 + x + 1
+#define CRC8_POLYNOMIAL 0x2F
+
+static uint8_t prv_crc8_bitwise(uint8_t crc, const uint8_t *data, size_t length) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    crc ^= data[i];
+    int bit;
+    for (bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLYNOMIAL) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void prv_test_every_byte_and_crc(void) {
+  int initial;
+  for (initial = 0; initial < 256; initial++) {
+    int data;
+    for (data = 0; data < 256; data++) {
+      const uint8_t byte = data;
+      const uint8_t expected = prv_crc8_bitwise(initial, &byte, 1);
+      uint8_t full = initial;
+      uint8_t nibble = initial;
+      crc8_full_table_byte_streaming(byte, &full);
+      crc8_nibble_table_byte_streaming(byte, &nibble);
+      TEST_ASSERT_EQUAL(expected, full);
+      TEST_ASSERT_EQUAL(expected, nibble);
+    }
+  }
+}
+
+static void prv_test_buffers(void) {
+  uint8_t data[1024];
+  uint32_t seed = 1;
+  size_t i;
+  for (i = 0; i < sizeof(data); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+  size_t length;
+  for (length = 0; length <= sizeof(data); length += (length < 64) ? 1 : 61) {
+    const uint8_t expected = prv_crc8_bitwise(0, data, length);
+    uint8_t full = 0;
+    uint8_t nibble = 0;
+    uint8_t library = 0;
+    crc8_full_table_buffer(data, length, &full);
+    crc8_nibble_table_buffer(data, length, &nibble);
+    crc8_calculate_buffer(data, length, &library);
+    TEST_ASSERT_EQUAL(expected, full);
+    TEST_ASSERT_EQUAL(expected, nibble);
+    TEST_ASSERT_EQUAL(expected, library);
+  }
+}
+
+static void prv_test_check_value(void) {
+  // a frame is valid when the CRC over everything including the checksum byte comes out as 0
+  const char *check = "123456789";
+  uint8_t frame[10];
+  memcpy(frame, check, 9);
+  frame[9] = prv_crc8_bitwise(0, frame, 9);
+  uint8_t full = 0;
+  uint8_t nibble = 0;
+  crc8_full_table_buffer(frame, sizeof(frame), &full);
+  crc8_nibble_table_buffer(frame, sizeof(frame), &nibble);
+  TEST_ASSERT_EQUAL(0, full);
+  TEST_ASSERT_EQUAL(0, nibble);
+}
+
+int main(void) {
+  prv_test_every_byte_and_crc();
+  prv_test_buffers();
+  prv_test_check_value();
+  return test_result();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * crc.c built with each setting of CRC8_USE_FULL_TABLE (see crc_full_table.c and
+ * crc_nibble_table.c), so both can be tested and benchmarked on the host side by side.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void crc8_full_table_byte_streaming(const uint8_t data, uint8_t *crc);
+void crc8_full_table_buffer(const uint8_t *data, size_t length, uint8_t *crc);
+void crc8_nibble_table_byte_streaming(const uint8_t data, uint8_t *crc);
+void crc8_nibble_table_buffer(const uint8_t *data, size_t length, uint8_t *crc);
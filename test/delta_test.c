@@ -0,0 +1,306 @@
+/*
+ * Checks that the runs from delta_next_run() always bring an old copy of a value up to date with
+ * delta_apply(), and that delta_apply() rejects responses it can't use. Then reads a value
+ * attribute through the simulated link (sim.h), in full and as deltas after various changes, and
+ * checks how many bytes each read puts on the wire, and that a value which can't be sent isn't
+ * taken to be the watch's copy.
+ */
+
+#include <string.h>
+
+#include "delta.h"
+#include "sim.h"
+#include "test.h"
+
+#define NUM_TRIALS          2000
+#define VALUE_LENGTH        128
+#define DELTA_ATTRIBUTE_ID  0x0002
+// the sequence number and format byte at the start of every delta response
+#define HEADER_LENGTH       2
+#define RUN_HEADER_LENGTH   2
+
+static uint32_t prv_random(uint32_t *seed, uint32_t range) {
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) % range;
+}
+
+// Encodes the runs between the two values the same way the strap does, and returns the length.
+static size_t prv_encode_runs(const uint8_t *value, const uint8_t *last_value, size_t length,
+                              uint8_t *data) {
+  size_t data_length = 0;
+  size_t offset = 0;
+  size_t run_length;
+  while ((offset = delta_next_run(value, last_value, length, offset, &run_length)) < length) {
+    TEST_ASSERT(run_length > 0);
+    TEST_ASSERT(run_length <= DELTA_MAX_RUN_LENGTH);
+    // a run starts and ends with a byte which changed
+    TEST_ASSERT(value[offset] != last_value[offset]);
+    TEST_ASSERT(value[offset + run_length - 1] != last_value[offset + run_length - 1]);
+    data[data_length++] = offset;
+    data[data_length++] = run_length;
+    memcpy(&data[data_length], &value[offset], run_length);
+    data_length += run_length;
+    offset += run_length;
+  }
+  TEST_ASSERT_EQUAL(0, run_length);
+  return data_length;
+}
+
+static void prv_test_round_trip(void) {
+  uint8_t value[DELTA_MAX_VALUE_LENGTH];
+  uint8_t last_value[DELTA_MAX_VALUE_LENGTH];
+  uint8_t watch_value[DELTA_MAX_VALUE_LENGTH];
+  // every byte can be a run of its own, which needs a header
+  uint8_t response[HEADER_LENGTH + 3 * DELTA_MAX_VALUE_LENGTH];
+  uint32_t seed = 1;
+  int trial;
+  for (trial = 0; trial < NUM_TRIALS; trial++) {
+    const size_t length = 1 + prv_random(&seed, DELTA_MAX_VALUE_LENGTH);
+    size_t i;
+    for (i = 0; i < length; i++) {
+      last_value[i] = prv_random(&seed, 256);
+    }
+    memcpy(value, last_value, length);
+    // from no changes at all up to changing most of the value, in clusters of various sizes
+    const size_t num_changes = prv_random(&seed, length + 1);
+    for (i = 0; i < num_changes; i++) {
+      const size_t start = prv_random(&seed, length);
+      const size_t end = start + 1 + prv_random(&seed, (trial % 4 == 0) ? length : 4);
+      size_t j;
+      for (j = start; (j < end) && (j < length); j++) {
+        value[j] = last_value[j] + 1 + prv_random(&seed, 255);
+      }
+    }
+
+    response[0] = 1 + prv_random(&seed, UINT8_MAX);
+    response[1] = DELTA_FORMAT_RUNS;
+    const size_t response_length = HEADER_LENGTH +
+                                   prv_encode_runs(value, last_value, length,
+                                                   &response[HEADER_LENGTH]);
+    memcpy(watch_value, last_value, length);
+    uint8_t sequence = 0;
+    TEST_ASSERT(delta_apply(watch_value, length, &sequence, response, response_length));
+    TEST_ASSERT_EQUAL(response[0], sequence);
+    TEST_ASSERT(memcmp(watch_value, value, length) == 0);
+
+    // and the full value, which doesn't need the old copy
+    response[1] = DELTA_FORMAT_FULL;
+    memcpy(&response[HEADER_LENGTH], value, length);
+    memset(watch_value, 0, length);
+    TEST_ASSERT(delta_apply(watch_value, length, &sequence, response, HEADER_LENGTH + length));
+    TEST_ASSERT(memcmp(watch_value, value, length) == 0);
+  }
+}
+
+static void prv_test_long_run(void) {
+  // a change to every byte of the longest value is more than a run can hold
+  uint8_t value[DELTA_MAX_VALUE_LENGTH];
+  uint8_t last_value[DELTA_MAX_VALUE_LENGTH];
+  uint8_t response[HEADER_LENGTH + DELTA_MAX_VALUE_LENGTH + 2 * RUN_HEADER_LENGTH];
+  memset(last_value, 0, sizeof(last_value));
+  memset(value, 1, sizeof(value));
+  size_t run_length;
+  TEST_ASSERT_EQUAL(0, delta_next_run(value, last_value, sizeof(value), 0, &run_length));
+  TEST_ASSERT_EQUAL(DELTA_MAX_RUN_LENGTH, run_length);
+  TEST_ASSERT_EQUAL(DELTA_MAX_RUN_LENGTH,
+                    delta_next_run(value, last_value, sizeof(value), run_length, &run_length));
+  TEST_ASSERT_EQUAL(DELTA_MAX_VALUE_LENGTH - DELTA_MAX_RUN_LENGTH, run_length);
+
+  response[0] = 1;
+  response[1] = DELTA_FORMAT_RUNS;
+  const size_t response_length = HEADER_LENGTH +
+                                 prv_encode_runs(value, last_value, sizeof(value),
+                                                 &response[HEADER_LENGTH]);
+  TEST_ASSERT_EQUAL(sizeof(response), response_length);
+  uint8_t sequence = 0;
+  TEST_ASSERT(delta_apply(last_value, sizeof(last_value), &sequence, response, response_length));
+  TEST_ASSERT(memcmp(last_value, value, sizeof(value)) == 0);
+}
+
+// Checks that delta_apply() rejects the response without touching the value, and resets the
+// sequence number so that the next request gets the full value.
+static void prv_check_invalid(const uint8_t *response, size_t response_length) {
+  const uint8_t original[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  uint8_t value[sizeof(original)];
+  memcpy(value, original, sizeof(value));
+  uint8_t sequence = 9;
+  TEST_ASSERT(!delta_apply(value, sizeof(value), &sequence, response, response_length));
+  TEST_ASSERT_EQUAL(0, sequence);
+  TEST_ASSERT(memcmp(value, original, sizeof(value)) == 0);
+}
+
+static void prv_test_invalid(void) {
+  // too short for the header
+  const uint8_t no_format[] = { 1 };
+  prv_check_invalid(no_format, 0);
+  prv_check_invalid(no_format, sizeof(no_format));
+  // a full value of the wrong length
+  const uint8_t short_full[] = { 1, DELTA_FORMAT_FULL, 1, 2, 3 };
+  prv_check_invalid(short_full, sizeof(short_full));
+  // an unknown format
+  const uint8_t bad_format[] = { 1, 2, 0, 1, 0xAA };
+  prv_check_invalid(bad_format, sizeof(bad_format));
+  // a valid run followed by one which runs off the end of the value
+  const uint8_t past_end[] = { 1, DELTA_FORMAT_RUNS, 0, 1, 0xAA, 6, 3, 0xAA, 0xAA, 0xAA };
+  prv_check_invalid(past_end, sizeof(past_end));
+  // a run which is longer than the response, and a run header which is cut short
+  const uint8_t cut_short[] = { 1, DELTA_FORMAT_RUNS, 0, 1, 0xAA, 2, 4, 0xAA, 0xAA };
+  prv_check_invalid(cut_short, sizeof(cut_short));
+  prv_check_invalid(cut_short, 6);
+}
+
+typedef struct {
+  Sim sim;
+  uint8_t value[VALUE_LENGTH];
+  uint8_t last_value[VALUE_LENGTH];
+  PebbleDeltaState delta;
+  // the watch's copy of the value
+  uint8_t watch_value[VALUE_LENGTH];
+  uint8_t watch_sequence;
+  // the bytes on the wire for a response with no data
+  size_t wire_overhead;
+} DeltaLink;
+
+// Reads the value (as a delta if is_delta is set) and returns the bytes the strap sent back, and
+// the length of the data in the response.
+static size_t prv_read(DeltaLink *link, bool is_delta, uint8_t watch_sequence,
+                       size_t *data_length) {
+  const uint64_t start_bytes = link->sim.stats.bytes_to_watch;
+  MasterFrame response;
+  const uint8_t *data;
+  *data_length = 0;
+  const bool success = is_delta ?
+      sim_generic(&link->sim, SmartstrapRequestTypeWriteRead, SIM_SERVICE_ID, DELTA_ATTRIBUTE_ID,
+                  &watch_sequence, 1, &response, &data, data_length) :
+      sim_generic(&link->sim, SmartstrapRequestTypeRead, SIM_SERVICE_ID, DELTA_ATTRIBUTE_ID,
+                  NULL, 0, &response, &data, data_length);
+  TEST_ASSERT(success);
+  if (success && is_delta) {
+    TEST_ASSERT(delta_apply(link->watch_value, VALUE_LENGTH, &link->watch_sequence, data,
+                            *data_length));
+    TEST_ASSERT(memcmp(link->watch_value, link->value, VALUE_LENGTH) == 0);
+  }
+  return link->sim.stats.bytes_to_watch - start_bytes;
+}
+
+// Reads a delta of the value as it is now, and checks how much data it took.
+static void prv_check_delta(DeltaLink *link, size_t expected_data_length) {
+  size_t data_length;
+  const size_t wire_length = prv_read(link, true, link->watch_sequence, &data_length);
+  TEST_ASSERT_EQUAL(expected_data_length, data_length);
+  // allow for the header and checksum bytes needing to be escaped
+  TEST_ASSERT(wire_length >= link->wire_overhead + expected_data_length);
+  TEST_ASSERT(wire_length <= link->wire_overhead + expected_data_length + 2);
+}
+
+static void prv_test_wire_bytes(void) {
+  static DeltaLink link;
+  static PebbleAttribute attributes[1];
+  memset(&link, 0, sizeof(link));
+  size_t i;
+  for (i = 0; i < VALUE_LENGTH; i++) {
+    // keep clear of the bytes which need escaping, so the data goes on the wire as it is
+    link.value[i] = 1 + (i % 100);
+  }
+  link.delta.last_value = link.last_value;
+  attributes[0] = (PebbleAttribute) {
+    .service_id = SIM_SERVICE_ID,
+    .attribute_id = DELTA_ATTRIBUTE_ID,
+    .max_length = VALUE_LENGTH,
+    .request_types = SmartstrapRequestMaskRead | SmartstrapRequestMaskWriteRead,
+    .value = link.value,
+    .delta = &link.delta
+  };
+  TEST_ASSERT(sim_init(&link.sim, PebbleBaud57600));
+  pebble_ctx_set_attributes(&link.sim.strap, attributes, 1);
+  TEST_ASSERT(sim_connect(&link.sim));
+
+  // a plain read sends the whole value every time
+  size_t data_length;
+  const size_t full_wire_length = prv_read(&link, false, 0, &data_length);
+  TEST_ASSERT_EQUAL(VALUE_LENGTH, data_length);
+  link.wire_overhead = full_wire_length - VALUE_LENGTH;
+
+  // the first delta read has nothing to go on, so it's the full value
+  prv_check_delta(&link, HEADER_LENGTH + VALUE_LENGTH);
+  const uint8_t first_sequence = link.watch_sequence;
+  TEST_ASSERT(first_sequence != 0);
+
+  // nothing has changed, so there's just the header and the sequence number stays the same
+  prv_check_delta(&link, HEADER_LENGTH);
+  TEST_ASSERT_EQUAL(first_sequence, link.watch_sequence);
+
+  // one byte
+  link.value[40]++;
+  prv_check_delta(&link, HEADER_LENGTH + RUN_HEADER_LENGTH + 1);
+  TEST_ASSERT(link.watch_sequence != first_sequence);
+
+  // two bytes close enough together to go in one run, and two which are far apart
+  link.value[10]++;
+  link.value[12]++;
+  prv_check_delta(&link, HEADER_LENGTH + RUN_HEADER_LENGTH + 3);
+  link.value[20]++;
+  link.value[100]++;
+  prv_check_delta(&link, HEADER_LENGTH + 2 * (RUN_HEADER_LENGTH + 1));
+
+  // when the runs would be longer than the value, it's sent in full
+  for (i = 0; i < VALUE_LENGTH; i += 2) {
+    link.value[i]++;
+  }
+  prv_check_delta(&link, HEADER_LENGTH + VALUE_LENGTH);
+
+  // a watch with an old copy gets the full value
+  link.value[0]++;
+  link.watch_sequence = first_sequence;
+  prv_check_delta(&link, HEADER_LENGTH + VALUE_LENGTH);
+
+  // so a small change takes a fraction of the bytes of a plain read
+  link.value[64]++;
+  const size_t delta_wire_length = prv_read(&link, true, link.watch_sequence, &data_length);
+  TEST_ASSERT(delta_wire_length < full_wire_length / 4);
+
+  TEST_ASSERT_EQUAL(0, link.sim.stats.errors);
+  sim_deinit(&link.sim);
+}
+
+static void prv_test_unsent(void) {
+  // with the header, a full response for this is too long to send
+  static uint8_t value[UINT16_MAX - 1];
+  static uint8_t last_value[sizeof(value)];
+  static PebbleAttribute attributes[1];
+  static Sim sim;
+  PebbleDeltaState delta = { .last_value = last_value };
+  memset(value, 0xAA, sizeof(value));
+  memset(last_value, 0, sizeof(last_value));
+  attributes[0] = (PebbleAttribute) {
+    .service_id = SIM_SERVICE_ID,
+    .attribute_id = DELTA_ATTRIBUTE_ID,
+    .max_length = sizeof(value),
+    .request_types = SmartstrapRequestMaskWriteRead,
+    .value = value,
+    .delta = &delta
+  };
+  TEST_ASSERT(sim_init(&sim, PebbleBaud57600));
+  pebble_ctx_set_attributes(&sim.strap, attributes, 1);
+  TEST_ASSERT(sim_connect(&sim));
+
+  const uint8_t watch_sequence = 0;
+  MasterFrame response;
+  const uint8_t *data;
+  size_t data_length;
+  TEST_ASSERT(!sim_generic(&sim, SmartstrapRequestTypeWriteRead, SIM_SERVICE_ID,
+                           DELTA_ATTRIBUTE_ID, &watch_sequence, 1, &response, &data,
+                           &data_length));
+  TEST_ASSERT_EQUAL(0, delta.sequence);
+  TEST_ASSERT_EQUAL(0, last_value[0]);
+  sim_deinit(&sim);
+}
+
+int main(void) {
+  prv_test_round_trip();
+  prv_test_long_run();
+  prv_test_invalid();
+  prv_test_wire_bytes();
+  prv_test_unsent();
+  return test_result();
+}
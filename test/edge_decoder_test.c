@@ -0,0 +1,181 @@
+/*
+ * Runs the input capture decoder (utility/edge_decoder.h) against a modelled line at each baud
+ * rate. The sender's baud rate is off by up to 3% either way, its edges are moved around by up to
+ * 5% of a bit and there are idle gaps between some of the bytes. The edges are timestamped with a
+ * 16MHz timer which wraps at 16 bits and the timeout is taken the same way as the compare interrupt
+ * in OneWireSoftSerial, so every byte must come out as it was sent. Breaks and glitches are checked
+ * as well.
+ */
+
+#include <string.h>
+
+#include "edge_decoder.h"
+#include "sim.h"
+#include "test.h"
+
+#define F_CPU           16000000
+#define NUM_BYTES       300
+#define NUM_TRIALS      20
+// the most the sender's baud rate is off by, in tenths of a percent
+#define MAX_BAUD_ERROR  30
+// the most an edge is moved by, in thousandths of a bit
+#define MAX_JITTER      50
+
+typedef struct {
+  // the time of the edge in seconds and the level of the line after it
+  double time;
+  bool level;
+} Edge;
+
+typedef struct {
+  Edge edges[NUM_BYTES * EDGE_DECODER_NUM_BITS + 2];
+  size_t num_edges;
+  bool level;
+  uint32_t seed;
+} Line;
+
+static uint32_t prv_random(Line *line, uint32_t range) {
+  line->seed = line->seed * 1103515245 + 12345;
+  return (line->seed >> 16) % range;
+}
+
+// a random value from -max to max
+static int prv_random_signed(Line *line, int max) {
+  return (int)prv_random(line, 2 * max + 1) - max;
+}
+
+static void prv_line_init(Line *line, uint32_t seed) {
+  line->num_edges = 0;
+  line->level = true;
+  line->seed = seed;
+}
+
+static void prv_set_level(Line *line, double time, bool level) {
+  if (level != line->level) {
+    line->edges[line->num_edges].time = time;
+    line->edges[line->num_edges].level = level;
+    line->num_edges++;
+    line->level = level;
+  }
+}
+
+// Sends a byte starting at the given time and returns the time at which it ends.
+static double prv_send_byte(Line *line, double time, double bit_time, uint8_t byte,
+                            int max_jitter) {
+  int i;
+  for (i = 0; i < EDGE_DECODER_NUM_BITS; i++) {
+    const bool level = (i == 0) ? false :
+                       (i == EDGE_DECODER_NUM_BITS - 1) ? true :
+                       ((byte >> (i - 1)) & 1);
+    // the start bit is where the decoder measures from, so only the edges after it move
+    const double jitter = i ? (prv_random_signed(line, max_jitter) * bit_time / 1000) : 0;
+    prv_set_level(line, time + i * bit_time + jitter, level);
+  }
+  return time + EDGE_DECODER_NUM_BITS * bit_time;
+}
+
+static uint16_t prv_ticks(double time) {
+  return (uint16_t)(uint64_t)(time * F_CPU + 0.5);
+}
+
+// Feeds the edges to the decoder the way the ISRs in OneWireSoftSerial do, and returns the number
+// of bytes received.
+static size_t prv_decode(const Line *line, uint32_t baud, uint8_t *received, size_t max_length,
+                         uint8_t *framing_errors) {
+  EdgeDecoder dec;
+  edge_decoder_init(&dec, EDGE_DECODER_BIT_TICKS(F_CPU, baud));
+  size_t length = 0;
+  uint8_t byte;
+  size_t i;
+  for (i = 0; i < line->num_edges; i++) {
+    const uint16_t time = prv_ticks(line->edges[i].time);
+    // the compare interrupt fires at the middle of the stop bit unless another edge comes first
+    if (dec.is_receiving &&
+        ((uint16_t)(time - dec.start_time) > EDGE_DECODER_STOP_TICKS(&dec)) &&
+        edge_decoder_timeout(&dec, &byte) && (length < max_length)) {
+      received[length++] = byte;
+    }
+    if (edge_decoder_handle_edge(&dec, time, line->edges[i].level, &byte) &&
+        (length < max_length)) {
+      received[length++] = byte;
+    }
+  }
+  if (edge_decoder_timeout(&dec, &byte) && (length < max_length)) {
+    received[length++] = byte;
+  }
+  *framing_errors = dec.framing_errors;
+  return length;
+}
+
+static void prv_check_bytes(uint32_t baud, int baud_error, int max_jitter, uint32_t seed) {
+  static Line line;
+  uint8_t sent[NUM_BYTES];
+  uint8_t received[NUM_BYTES + 1];
+  const double bit_time = 1 / (baud * (1 + baud_error / 1000.0));
+  double time = 0.001;
+  size_t i;
+  prv_line_init(&line, seed);
+  for (i = 0; i < NUM_BYTES; i++) {
+    sent[i] = prv_random(&line, 256);
+    if (prv_random(&line, 3) == 0) {
+      // leave the line idle for up to 3 bits
+      time += bit_time * prv_random(&line, 30) / 10;
+    }
+    time = prv_send_byte(&line, time, bit_time, sent[i], max_jitter);
+  }
+  uint8_t framing_errors;
+  const size_t length = prv_decode(&line, baud, received, sizeof(received), &framing_errors);
+  TEST_ASSERT_EQUAL(NUM_BYTES, length);
+  TEST_ASSERT_EQUAL(0, framing_errors);
+  if ((length != NUM_BYTES) || (memcmp(sent, received, NUM_BYTES) != 0)) {
+    fprintf(stderr, "  at %lu baud, %+.1f%% off, with %d/1000 of a bit of jitter\n",
+            (unsigned long)baud, baud_error / 10.0, max_jitter);
+    TEST_ASSERT(memcmp(sent, received, NUM_BYTES) == 0);
+  }
+}
+
+static void prv_test_break_and_glitch(uint32_t baud) {
+  static Line line;
+  const double bit_time = 1.0 / baud;
+  uint8_t received[4];
+  uint8_t framing_errors;
+  prv_line_init(&line, baud);
+
+  // a break holds the line low for longer than a byte, so there's no stop bit
+  double time = prv_send_byte(&line, 0.001, bit_time, 0x55, 0);
+  prv_set_level(&line, time, false);
+  time += 2 * EDGE_DECODER_NUM_BITS * bit_time;
+  prv_set_level(&line, time, true);
+  time = prv_send_byte(&line, time + bit_time, bit_time, 0xAA, 0);
+  TEST_ASSERT_EQUAL(2, prv_decode(&line, baud, received, sizeof(received), &framing_errors));
+  TEST_ASSERT_EQUAL(0x55, received[0]);
+  TEST_ASSERT_EQUAL(0xAA, received[1]);
+  TEST_ASSERT_EQUAL(1, framing_errors);
+
+  // a low pulse which is over before the middle of the start bit isn't a byte
+  prv_set_level(&line, time + bit_time, false);
+  prv_set_level(&line, time + bit_time * 1.4, true);
+  prv_send_byte(&line, time + 3 * bit_time, bit_time, 0x7E, 0);
+  TEST_ASSERT_EQUAL(3, prv_decode(&line, baud, received, sizeof(received), &framing_errors));
+  TEST_ASSERT_EQUAL(0x7E, received[2]);
+  TEST_ASSERT_EQUAL(1, framing_errors);
+}
+
+int main(void) {
+  int baud;
+  for (baud = 0; baud < PebbleBaudInvalid; baud++) {
+    const uint32_t rate = sim_baud_rate(baud);
+    prv_check_bytes(rate, 0, 0, baud);
+    prv_check_bytes(rate, MAX_BAUD_ERROR, 0, baud);
+    prv_check_bytes(rate, -MAX_BAUD_ERROR, 0, baud);
+    int trial;
+    for (trial = 0; trial < NUM_TRIALS; trial++) {
+      uint32_t seed = baud * NUM_TRIALS + trial;
+      seed = seed * 1103515245 + 12345;
+      const int baud_error = (int)((seed >> 16) % (2 * MAX_BAUD_ERROR + 1)) - MAX_BAUD_ERROR;
+      prv_check_bytes(rate, baud_error, MAX_JITTER, seed);
+    }
+    prv_test_break_and_glitch(rate);
+  }
+  return test_result();
+}
@@ -0,0 +1,9 @@
+#include "encoding_variants.h"
+
+#define ENCODING_WORD_SCAN 0
+#define ENCODING_SIMD_SCAN 0
+#define encoding_streaming_decode_reset encoding_bytewise_streaming_decode_reset
+#define encoding_streaming_decode encoding_bytewise_streaming_decode
+#define encoding_encode encoding_bytewise_encode
+#define encoding_find_special encoding_bytewise_find_special
+#include "encoding.c"
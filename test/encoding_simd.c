@@ -0,0 +1,9 @@
+#include "encoding_variants.h"
+
+#define ENCODING_WORD_SCAN 1
+#define ENCODING_SIMD_SCAN 1
+#define encoding_streaming_decode_reset encoding_simd_streaming_decode_reset
+#define encoding_streaming_decode encoding_simd_streaming_decode
+#define encoding_encode encoding_simd_encode
+#define encoding_find_special encoding_simd_find_special
+#include "encoding.c"
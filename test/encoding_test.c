@@ -0,0 +1,176 @@
+/*
+ * Checks that every way of scanning for special bytes in encoding_find_special() agrees with a
+ * byte at a time scan, for every length up to a few SIMD blocks, from every alignment and with the
+ * special byte in every position. Then checks that frames survive being encoded and decoded in
+ * both directions.
+ */
+
+#include <string.h>
+
+#include "encoding.h"
+#include "encoding_variants.h"
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define MAX_LENGTH    80
+#define MAX_OFFSET    16
+
+typedef size_t (*FindSpecial)(const uint8_t *data, size_t length);
+
+static const FindSpecial FIND_SPECIAL[] = {
+  encoding_find_special,
+  encoding_bytewise_find_special,
+  encoding_word_find_special,
+  encoding_simd_find_special
+};
+
+static size_t prv_reference_find_special(const uint8_t *data, size_t length) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    if ((data[i] == ENCODING_FLAG) || (data[i] == ENCODING_ESCAPE)) {
+      return i;
+    }
+  }
+  return length;
+}
+
+static void prv_fill(uint8_t *data, size_t length, uint32_t seed) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+    if ((data[i] == ENCODING_FLAG) || (data[i] == ENCODING_ESCAPE)) {
+      // bytes which are one bit away from the special bytes catch sloppy comparisons
+      data[i] ^= 0x01;
+    }
+  }
+}
+
+static void prv_check_all(const uint8_t *data, size_t length) {
+  const size_t expected = prv_reference_find_special(data, length);
+  size_t i;
+  for (i = 0; i < sizeof(FIND_SPECIAL) / sizeof(FIND_SPECIAL[0]); i++) {
+    TEST_ASSERT_EQUAL(expected, FIND_SPECIAL[i](data, length));
+  }
+}
+
+static void prv_test_find_special(void) {
+  // there's room past the end of each scan, filled with special bytes which mustn't be found
+  static uint8_t buffer[MAX_OFFSET + MAX_LENGTH + 32];
+  const uint8_t specials[] = { ENCODING_FLAG, ENCODING_ESCAPE };
+  size_t offset;
+  for (offset = 0; offset < MAX_OFFSET; offset++) {
+    size_t length;
+    for (length = 0; length <= MAX_LENGTH; length++) {
+      uint8_t *data = &buffer[offset];
+      memset(buffer, ENCODING_FLAG, sizeof(buffer));
+      prv_fill(data, length, offset * 1000 + length);
+      prv_check_all(data, length);
+
+      size_t position;
+      for (position = 0; position < length; position++) {
+        size_t i;
+        for (i = 0; i < sizeof(specials); i++) {
+          const uint8_t original = data[position];
+          data[position] = specials[i];
+          prv_check_all(data, length);
+          // a second special byte after the first mustn't change the answer
+          if (position + 1 < length) {
+            data[length - 1] = specials[1 - i];
+            prv_check_all(data, length);
+            prv_fill(&data[length - 1], 1, length);
+          }
+          data[position] = original;
+        }
+      }
+    }
+  }
+}
+
+static void prv_test_byte_round_trip(void) {
+  int value;
+  for (value = 0; value < 256; value++) {
+    uint8_t byte = value;
+    const bool is_escaped = encoding_encode(&byte);
+    TEST_ASSERT_EQUAL((value == ENCODING_FLAG) || (value == ENCODING_ESCAPE), is_escaped);
+
+    EncodingStreamingContext ctx;
+    encoding_streaming_decode_reset(&ctx);
+    bool should_store;
+    bool encoding_error;
+    if (is_escaped) {
+      uint8_t escape = ENCODING_ESCAPE;
+      TEST_ASSERT(!encoding_streaming_decode(&ctx, &escape, &should_store, &encoding_error));
+      TEST_ASSERT(!should_store && !encoding_error);
+    }
+    TEST_ASSERT(!encoding_streaming_decode(&ctx, &byte, &should_store, &encoding_error));
+    TEST_ASSERT(should_store && !encoding_error);
+    TEST_ASSERT_EQUAL(value, byte);
+  }
+}
+
+typedef struct {
+  PebbleSerialContext ctx;
+  MasterDecoder decoder;
+  MasterFrame frame;
+  bool has_frame;
+} RoundTrip;
+
+static void prv_round_trip_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  RoundTrip *round_trip = context;
+  if (cmd == SmartstrapCmdWriteByte) {
+    if (master_decoder_feed(&round_trip->decoder, arg, &round_trip->frame)) {
+      round_trip->has_frame = true;
+    }
+  }
+}
+
+static void prv_test_frame_round_trip(void) {
+  static const uint16_t SERVICES[] = { 0x0000 };
+  static RoundTrip round_trip;
+  static uint8_t payload[GET_PAYLOAD_BUFFER_SIZE(256)];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(256)];
+  uint8_t data[256];
+  size_t length;
+  for (length = 0; length <= sizeof(data); length += (length < 40) ? 1 : 27) {
+    // every byte value, with more special bytes as the length goes up
+    size_t i;
+    for (i = 0; i < length; i++) {
+      data[i] = (i % 3 == 0) ? ENCODING_FLAG : (i % 5 == 0) ? ENCODING_ESCAPE : (i * 7);
+    }
+    pebble_ctx_init(&round_trip.ctx, prv_round_trip_callback, &round_trip, PebbleBaud9600,
+                    SERVICES, 1);
+    pebble_ctx_prepare_for_read(&round_trip.ctx, payload, sizeof(payload));
+    master_decoder_init(&round_trip.decoder);
+    round_trip.has_frame = false;
+
+    // from the watch to the strap, as a raw data write-read
+    const size_t frame_length = master_encode_frame(frame, true, SmartstrapProfileRawData, data,
+                                                    length);
+    size_t consumed;
+    uint16_t service_id;
+    uint16_t attribute_id;
+    size_t payload_length;
+    SmartstrapRequestType type;
+    TEST_ASSERT(pebble_ctx_handle_bytes(&round_trip.ctx, frame, frame_length, &consumed,
+                                        &service_id, &attribute_id, &payload_length, &type, 0));
+    TEST_ASSERT_EQUAL(frame_length, consumed);
+    TEST_ASSERT_EQUAL(length, payload_length);
+    TEST_ASSERT(memcmp(payload, data, length) == 0);
+
+    // and back again as the response
+    TEST_ASSERT(pebble_ctx_write(&round_trip.ctx, true, data, length));
+    TEST_ASSERT(round_trip.has_frame);
+    TEST_ASSERT_EQUAL(SmartstrapProfileRawData, round_trip.frame.profile);
+    TEST_ASSERT_EQUAL(length, round_trip.frame.length);
+    TEST_ASSERT(memcmp(round_trip.frame.payload, data, length) == 0);
+  }
+}
+
+int main(void) {
+  prv_test_find_special();
+  prv_test_byte_round_trip();
+  prv_test_frame_round_trip();
+  return test_result();
+}
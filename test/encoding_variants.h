@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * encoding_find_special() from encoding.c built with each way of scanning: a byte at a time, a word
+ * at a time, and with SSE2 / NEON (where the host has them). See encoding_bytewise.c,
+ * encoding_word.c and encoding_simd.c.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t encoding_bytewise_find_special(const uint8_t *data, size_t length);
+size_t encoding_word_find_special(const uint8_t *data, size_t length);
+size_t encoding_simd_find_special(const uint8_t *data, size_t length);
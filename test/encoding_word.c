@@ -0,0 +1,9 @@
+#include "encoding_variants.h"
+
+#define ENCODING_WORD_SCAN 1
+#define ENCODING_SIMD_SCAN 0
+#define encoding_streaming_decode_reset encoding_word_streaming_decode_reset
+#define encoding_streaming_decode encoding_word_streaming_decode
+#define encoding_encode encoding_word_encode
+#define encoding_find_special encoding_word_find_special
+#include "encoding.c"
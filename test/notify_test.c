@@ -0,0 +1,114 @@
+/*
+ * Checks that a queued notification isn't sent while the watch is waiting for a response to its
+ * last request, and that the notification timeout is measured against the time passed in rather
+ * than the time of the last byte received.
+ */
+
+#include <string.h>
+
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define BUFFER_LENGTH   32
+#define SERVICE_ID      0x1001
+#define ATTRIBUTE_ID    0x0001
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[GET_PAYLOAD_BUFFER_SIZE(BUFFER_LENGTH)];
+  // the number of breaks written, three for each notification
+  uint32_t num_breaks;
+} NotifyTest;
+
+static NotifyTest s_test;
+
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  NotifyTest *test = context;
+  (void)arg;
+  if (cmd == SmartstrapCmdWriteBreak) {
+    test->num_breaks++;
+  }
+}
+
+static void prv_init(void) {
+  static const uint16_t SERVICES[] = { 0x0000, SERVICE_ID };
+  NotifyTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 2);
+  pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload));
+}
+
+// Receives a request at the given time, returning true if it was passed up to be responded to.
+static bool prv_request(NotifyTest *test, SmartstrapProfile profile, bool is_read, uint32_t time) {
+  static uint8_t payload[sizeof(GenericServicePayload)];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(sizeof(payload))];
+  size_t payload_length = 0;
+  if (profile == SmartstrapProfileGenericService) {
+    payload_length = master_generic_payload(payload, SmartstrapRequestTypeRead, SERVICE_ID,
+                                            ATTRIBUTE_ID, NULL, 0);
+  }
+  const size_t frame_length = master_encode_frame(frame, is_read, profile, payload,
+                                                  payload_length);
+  size_t consumed;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  return pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                 &attribute_id, &length, &type, time);
+}
+
+static void prv_test_held_for_response(void) {
+  NotifyTest *test = &s_test;
+  prv_init();
+  TEST_ASSERT(prv_request(test, SmartstrapProfileGenericService, true, 0));
+
+  // the watch is waiting for the response, so the notification has to wait too
+  TEST_ASSERT(pebble_ctx_notify(&test->ctx, SERVICE_ID, ATTRIBUTE_ID, 10));
+  pebble_ctx_is_connected(&test->ctx, 20);
+  TEST_ASSERT_EQUAL(0, test->num_breaks);
+
+  // and goes out once the response has been sent
+  TEST_ASSERT(pebble_ctx_write(&test->ctx, true, NULL, 0));
+  TEST_ASSERT_EQUAL(0, test->num_breaks);
+  pebble_ctx_is_connected(&test->ctx, 30);
+  TEST_ASSERT_EQUAL(3, test->num_breaks);
+}
+
+static void prv_test_unanswered_request(void) {
+  NotifyTest *test = &s_test;
+  prv_init();
+
+  // the watch doesn't wait for a response to a raw data write
+  TEST_ASSERT(prv_request(test, SmartstrapProfileRawData, false, 0));
+  TEST_ASSERT(pebble_ctx_notify(&test->ctx, SERVICE_ID, ATTRIBUTE_ID, 10));
+  TEST_ASSERT_EQUAL(3, test->num_breaks);
+
+  // nor for a read which was never responded to, once it has given up on it
+  prv_init();
+  TEST_ASSERT(prv_request(test, SmartstrapProfileGenericService, true, 0));
+  TEST_ASSERT(pebble_ctx_notify(&test->ctx, SERVICE_ID, ATTRIBUTE_ID, 10));
+  TEST_ASSERT_EQUAL(0, test->num_breaks);
+  pebble_ctx_is_connected(&test->ctx, 2000);
+  TEST_ASSERT_EQUAL(3, test->num_breaks);
+}
+
+static void prv_test_timeout_without_rx(void) {
+  NotifyTest *test = &s_test;
+  prv_init();
+  TEST_ASSERT(pebble_ctx_notify(&test->ctx, SERVICE_ID, ATTRIBUTE_ID, 100));
+  TEST_ASSERT_EQUAL(3, test->num_breaks);
+
+  // the watch never reads the notification info, and nothing has been received since, so this is
+  // only sent if the first one times out against the time passed in here
+  TEST_ASSERT(pebble_ctx_notify(&test->ctx, SERVICE_ID, ATTRIBUTE_ID + 1, 1200));
+  TEST_ASSERT_EQUAL(6, test->num_breaks);
+}
+
+int main(void) {
+  prv_test_held_for_response();
+  prv_test_unanswered_request();
+  prv_test_timeout_without_rx();
+  return test_result();
+}
@@ -0,0 +1,85 @@
+/*
+ * Checks that a payload buffer which the library already has (as the one being received into, or
+ * queued after it) can't be handed over again, and that it can be once its frame is returned.
+ */
+
+#include <string.h>
+
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define BUFFER_LENGTH   32
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payloads[PEBBLE_MAX_RX_BUFFERS + 1][BUFFER_LENGTH];
+} RxBufferTest;
+
+static RxBufferTest s_test;
+
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  (void)context;
+  (void)cmd;
+  (void)arg;
+}
+
+static void prv_init(void) {
+  static const uint16_t SERVICES[] = { 0x0000 };
+  RxBufferTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 1);
+}
+
+static bool prv_prepare(RxBufferTest *test, size_t index) {
+  return pebble_ctx_prepare_for_read(&test->ctx, test->payloads[index], BUFFER_LENGTH);
+}
+
+static void prv_test_duplicates(void) {
+  RxBufferTest *test = &s_test;
+  prv_init();
+
+  // the buffer being received into
+  TEST_ASSERT(prv_prepare(test, 0));
+  TEST_ASSERT(!prv_prepare(test, 0));
+
+  // and a queued one
+  TEST_ASSERT(prv_prepare(test, 1));
+  TEST_ASSERT(!prv_prepare(test, 1));
+  TEST_ASSERT(!prv_prepare(test, 0));
+
+  // the rejected ones didn't take up any of the queue
+  size_t i;
+  for (i = 2; i <= PEBBLE_MAX_RX_BUFFERS; i++) {
+    TEST_ASSERT(prv_prepare(test, i));
+  }
+}
+
+static void prv_test_handed_back(void) {
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(1)];
+  RxBufferTest *test = &s_test;
+  prv_init();
+  TEST_ASSERT(prv_prepare(test, 0));
+  TEST_ASSERT(prv_prepare(test, 1));
+
+  // once its frame is returned, the first buffer belongs to the application again
+  const uint8_t data = 0x55;
+  const size_t frame_length = master_encode_frame(frame, false, SmartstrapProfileRawData, &data,
+                                                  sizeof(data));
+  size_t consumed;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  TEST_ASSERT(pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                      &attribute_id, &length, &type, 0));
+  TEST_ASSERT_EQUAL(data, test->payloads[0][0]);
+  TEST_ASSERT(prv_prepare(test, 0));
+  TEST_ASSERT(!prv_prepare(test, 1));
+}
+
+int main(void) {
+  prv_test_duplicates();
+  prv_test_handed_back();
+  return test_result();
+}
@@ -0,0 +1,126 @@
+/*
+ * Builds OneWireSoftSerial against a host stand-in for the AVR core (in avr/) and checks that
+ * write_async() always calls its completion callback, even when TX was never enabled. The library
+ * waits for that callback before it sends anything else, so without it the next response would
+ * never go out.
+ */
+
+#include <string.h>
+
+#include "OneWireSoftSerial.h"
+
+extern "C" {
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+}
+
+#define PIN             2
+#define BUFFER_LENGTH   32
+
+// the registers which avr/ declares, with the line idle
+volatile uint8_t PINB = 0xFF;
+volatile uint8_t PORTB;
+volatile uint8_t PCICR;
+volatile uint8_t PCMSK0;
+volatile uint8_t SREG;
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[GET_PAYLOAD_BUFFER_SIZE(BUFFER_LENGTH)];
+  uint8_t tx_buffer[BUFFER_LENGTH];
+  // drops the requests to enable TX, as if the transport had never been able to turn the line around
+  bool drop_tx_enable;
+  uint32_t num_done;
+} SoftSerialTest;
+
+static SoftSerialTest s_test;
+
+static void prv_done(void) {
+  s_test.num_done++;
+  pebble_ctx_tx_complete(&s_test.ctx);
+}
+
+// Passes the library's commands on to OneWireSoftSerial the same way SoftwareSerialTransport does.
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  SoftSerialTest *test = (SoftSerialTest *)context;
+  switch (cmd) {
+  case SmartstrapCmdSetBaudRate:
+    OneWireSoftSerial::begin(PIN, arg);
+    break;
+  case SmartstrapCmdSetTxEnabled:
+    if (!arg || !test->drop_tx_enable) {
+      OneWireSoftSerial::set_tx_enabled(arg);
+    }
+    break;
+  case SmartstrapCmdWriteByte:
+    OneWireSoftSerial::write((uint8_t)arg);
+    break;
+  case SmartstrapCmdWriteBreak:
+    OneWireSoftSerial::write(0, true);
+    break;
+  case SmartstrapCmdWriteBuffer:
+    OneWireSoftSerial::write(test->tx_buffer, arg);
+    break;
+  case SmartstrapCmdWriteBufferAsync:
+    OneWireSoftSerial::write_async(test->tx_buffer, arg, prv_done);
+    break;
+  }
+}
+
+// Receives a raw data write-read and sends a response to it, returning false if the library was
+// left waiting for the last async write to finish.
+static bool prv_respond(SoftSerialTest *test) {
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(BUFFER_LENGTH)];
+  const uint8_t data[] = { 0x01, 0x02, 0x03 };
+  const size_t frame_length = master_encode_frame(frame, true, SmartstrapProfileRawData, data,
+                                                  sizeof(data));
+  size_t consumed;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  TEST_ASSERT(pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                      &attribute_id, &length, &type, 0));
+  TEST_ASSERT(pebble_ctx_write(&test->ctx, true, data, sizeof(data)));
+  pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload));
+  return !pebble_ctx_is_tx_busy(&test->ctx);
+}
+
+static void prv_test_disabled_write_async(void) {
+  // on its own, with TX never having been enabled
+  SoftSerialTest *test = &s_test;
+  const uint8_t data[] = { 0x55 };
+  OneWireSoftSerial::begin(PIN, 9600);
+  OneWireSoftSerial::write_async(data, sizeof(data), prv_done);
+  TEST_ASSERT_EQUAL(1, test->num_done);
+}
+
+static void prv_test_next_response(void) {
+  static const uint16_t SERVICES[] = { 0x0000 };
+  SoftSerialTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 1);
+  pebble_ctx_set_tx_buffer(&test->ctx, test->tx_buffer, sizeof(test->tx_buffer));
+  pebble_ctx_set_tx_async(&test->ctx, true);
+  pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload));
+
+  // the first response can't go out, but mustn't leave the library waiting for it
+  test->drop_tx_enable = true;
+  const bool is_done = prv_respond(test);
+  TEST_ASSERT(is_done);
+  TEST_ASSERT_EQUAL(1, test->num_done);
+
+  // so the next one is sent as normal (this would hang if the first was still marked as busy)
+  test->drop_tx_enable = false;
+  if (is_done) {
+    TEST_ASSERT(prv_respond(test));
+    TEST_ASSERT_EQUAL(2, test->num_done);
+  }
+}
+
+int main(void) {
+  prv_test_disabled_write_async();
+  prv_test_next_response();
+  return test_result();
+}
@@ -0,0 +1,243 @@
+/*
+ * Checks the events which a stream handler gets for frames which are longer than the payload
+ * buffer, decoding them with both pebble_ctx_handle_bytes() and pebble_ctx_decode_byte(): whole
+ * frames are passed on and then ended, frames which turn out to be invalid are aborted, and frames
+ * which the attribute table doesn't allow are rejected without the handler seeing any of them.
+ * Raw data frames, whose length the table can only check as they arrive, are aborted once they go
+ * over it.
+ */
+
+#include <string.h>
+
+#include "master.h"
+#include "PebbleSerial.h"
+#include "test.h"
+
+#define BUFFER_LENGTH   32
+#define DATA_LENGTH     100
+#define SERVICE_ID      0x1001
+#define ATTRIBUTE_ID    0x0001
+
+typedef struct {
+  PebbleSerialContext ctx;
+  uint8_t payload[BUFFER_LENGTH];
+  MasterDecoder decoder;
+  MasterFrame response;
+  bool has_response;
+  // the attribute which the frames are for
+  uint16_t service_id;
+  uint16_t attribute_id;
+  // what the stream handler has been passed
+  uint8_t data[DATA_LENGTH];
+  size_t data_length;
+  uint32_t num_ends;
+  uint32_t num_aborts;
+  size_t end_length;
+} StreamTest;
+
+static StreamTest s_test;
+
+static void prv_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  StreamTest *test = context;
+  if ((cmd == SmartstrapCmdWriteByte) &&
+      master_decoder_feed(&test->decoder, arg, &test->response)) {
+    test->has_response = true;
+  }
+}
+
+static void prv_stream_handler(PebbleSerialContext *ctx, PebbleStreamEvent event,
+                               uint16_t service_id, uint16_t attribute_id, const uint8_t *data,
+                               size_t length) {
+  StreamTest *test = &s_test;
+  TEST_ASSERT(ctx == &test->ctx);
+  TEST_ASSERT_EQUAL(test->service_id, service_id);
+  TEST_ASSERT_EQUAL(test->attribute_id, attribute_id);
+  switch (event) {
+  case PebbleStreamEventData:
+    TEST_ASSERT(test->data_length + length <= sizeof(test->data));
+    if (test->data_length + length <= sizeof(test->data)) {
+      memcpy(&test->data[test->data_length], data, length);
+      test->data_length += length;
+    }
+    break;
+  case PebbleStreamEventEnd:
+    test->num_ends++;
+    test->end_length = length;
+    break;
+  case PebbleStreamEventAbort:
+    test->num_aborts++;
+    break;
+  }
+}
+
+static void prv_init_for(uint16_t service_id, uint16_t attribute_id, uint8_t request_types) {
+  static const uint16_t SERVICES[] = { 0x0000, SERVICE_ID };
+  static PebbleAttribute attributes[1];
+  StreamTest *test = &s_test;
+  memset(test, 0, sizeof(*test));
+  test->service_id = service_id;
+  test->attribute_id = attribute_id;
+  pebble_ctx_init(&test->ctx, prv_callback, test, PebbleBaud9600, SERVICES, 2);
+  pebble_ctx_prepare_for_read(&test->ctx, test->payload, sizeof(test->payload));
+  pebble_ctx_set_stream_handler(&test->ctx, prv_stream_handler);
+  if (request_types) {
+    attributes[0] = (PebbleAttribute) {
+      .service_id = service_id,
+      .attribute_id = attribute_id,
+      .max_length = DATA_LENGTH,
+      .request_types = request_types
+    };
+    pebble_ctx_set_attributes(&test->ctx, attributes, 1);
+  }
+  master_decoder_init(&test->decoder);
+}
+
+static void prv_init(uint8_t request_types) {
+  prv_init_for(SERVICE_ID, ATTRIBUTE_ID, request_types);
+}
+
+static void prv_feed(bool use_isr, const uint8_t *frame, size_t frame_length) {
+  StreamTest *test = &s_test;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  size_t length;
+  SmartstrapRequestType type;
+  if (use_isr) {
+    size_t i;
+    for (i = 0; i < frame_length; i++) {
+      if (pebble_ctx_decode_byte(&test->ctx, frame[i])) {
+        TEST_ASSERT(!pebble_ctx_handle_ready_frame(&test->ctx, &service_id, &attribute_id,
+                                                   &length, &type, 0));
+      }
+    }
+  } else {
+    size_t consumed;
+    TEST_ASSERT(!pebble_ctx_handle_bytes(&test->ctx, frame, frame_length, &consumed, &service_id,
+                                         &attribute_id, &length, &type, 0));
+    TEST_ASSERT_EQUAL(frame_length, consumed);
+  }
+}
+
+// Sends a generic service write of DATA_LENGTH bytes, and returns the data which was sent.
+static const uint8_t *prv_send_write(bool use_isr, bool corrupt) {
+  static uint8_t data[DATA_LENGTH];
+  static uint8_t payload[sizeof(GenericServicePayload) + DATA_LENGTH];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(sizeof(payload))];
+  size_t i;
+  for (i = 0; i < sizeof(data); i++) {
+    data[i] = i * 7;
+  }
+  const size_t payload_length = master_generic_payload(payload, SmartstrapRequestTypeWrite,
+                                                       SERVICE_ID, ATTRIBUTE_ID, data,
+                                                       sizeof(data));
+  size_t frame_length = master_encode_frame(frame, false, SmartstrapProfileGenericService,
+                                            payload, payload_length);
+  if (corrupt) {
+    // the checksum is just before the closing flag
+    frame[frame_length - 2] ^= 0x01;
+  }
+  prv_feed(use_isr, frame, frame_length);
+  return data;
+}
+
+// Sends a raw data write of the given length (up to twice DATA_LENGTH).
+static void prv_send_raw_write(bool use_isr, size_t length) {
+  static uint8_t data[2 * DATA_LENGTH];
+  static uint8_t frame[MASTER_MAX_FRAME_LENGTH(sizeof(data))];
+  size_t i;
+  for (i = 0; i < length; i++) {
+    data[i] = i * 5;
+  }
+  const size_t frame_length = master_encode_frame(frame, false, SmartstrapProfileRawData, data,
+                                                  length);
+  prv_feed(use_isr, frame, frame_length);
+}
+
+static void prv_test_stream(bool use_isr) {
+  StreamTest *test = &s_test;
+  const uint8_t allowed_types[] = { 0, 1 << SmartstrapRequestTypeWrite };
+  size_t i;
+  for (i = 0; i < sizeof(allowed_types); i++) {
+    prv_init(allowed_types[i]);
+    const uint8_t *data = prv_send_write(use_isr, false);
+    TEST_ASSERT_EQUAL(DATA_LENGTH, test->data_length);
+    TEST_ASSERT(memcmp(test->data, data, DATA_LENGTH) == 0);
+    TEST_ASSERT_EQUAL(1, test->num_ends);
+    TEST_ASSERT_EQUAL(DATA_LENGTH, test->end_length);
+    TEST_ASSERT_EQUAL(0, test->num_aborts);
+    TEST_ASSERT(!test->has_response);
+  }
+}
+
+static void prv_test_abort(bool use_isr) {
+  StreamTest *test = &s_test;
+  prv_init(0);
+  prv_send_write(use_isr, true);
+  // some of the data was passed on before the checksum showed the frame was bad
+  TEST_ASSERT(test->data_length > 0);
+  TEST_ASSERT_EQUAL(0, test->num_ends);
+  TEST_ASSERT_EQUAL(1, test->num_aborts);
+  TEST_ASSERT(!test->has_response);
+}
+
+static void prv_test_rejected(bool use_isr) {
+  StreamTest *test = &s_test;
+  // the attribute only allows reads
+  prv_init(1 << SmartstrapRequestTypeRead);
+  prv_send_write(use_isr, false);
+  TEST_ASSERT_EQUAL(0, test->data_length);
+  TEST_ASSERT_EQUAL(0, test->num_ends);
+  TEST_ASSERT_EQUAL(0, test->num_aborts);
+  TEST_ASSERT(test->has_response);
+  GenericServicePayload header;
+  const uint8_t *data;
+  TEST_ASSERT(master_parse_generic(&test->response, &header, &data));
+  TEST_ASSERT(header.error != 0);
+
+  // an invalid frame which was never passed on doesn't need to be aborted
+  prv_init(1 << SmartstrapRequestTypeRead);
+  prv_send_write(use_isr, true);
+  TEST_ASSERT_EQUAL(0, test->data_length);
+  TEST_ASSERT_EQUAL(0, test->num_aborts);
+  TEST_ASSERT(!test->has_response);
+}
+
+static void prv_test_raw_too_long(bool use_isr) {
+  StreamTest *test = &s_test;
+  const uint8_t types = 1 << SmartstrapRequestTypeWrite;
+
+  // one which fits is passed on as normal
+  prv_init_for(0x0000, 0x0000, types);
+  prv_send_raw_write(use_isr, DATA_LENGTH);
+  TEST_ASSERT_EQUAL(DATA_LENGTH, test->data_length);
+  TEST_ASSERT_EQUAL(1, test->num_ends);
+  TEST_ASSERT_EQUAL(0, test->num_aborts);
+
+  // one which goes over while it's still arriving is aborted as soon as it does
+  prv_init_for(0x0000, 0x0000, types);
+  prv_send_raw_write(use_isr, 2 * DATA_LENGTH);
+  TEST_ASSERT(test->data_length <= DATA_LENGTH);
+  TEST_ASSERT_EQUAL(0, test->num_ends);
+  TEST_ASSERT_EQUAL(1, test->num_aborts);
+
+  // and one which only goes over with the last of it is aborted when it ends
+  prv_init_for(0x0000, 0x0000, types);
+  prv_send_raw_write(use_isr, DATA_LENGTH + 1);
+  TEST_ASSERT(test->data_length <= DATA_LENGTH);
+  TEST_ASSERT_EQUAL(0, test->num_ends);
+  TEST_ASSERT_EQUAL(1, test->num_aborts);
+
+  // raw data frames have no way to report an error, so none of these get a response
+  TEST_ASSERT(!test->has_response);
+}
+
+int main(void) {
+  int use_isr;
+  for (use_isr = 0; use_isr <= 1; use_isr++) {
+    prv_test_stream(use_isr);
+    prv_test_abort(use_isr);
+    prv_test_rejected(use_isr);
+    prv_test_raw_too_long(use_isr);
+  }
+  return test_result();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * A minimal set of assertions for the host tests. A failed assertion is reported and the test
+ * carries on, and test_result() gives the exit code for main().
+ */
+
+#include <stdio.h>
+
+static int s_test_failures;
+
+#define TEST_ASSERT(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); \
+      s_test_failures++; \
+    } \
+  } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual) \
+  do { \
+    const long long test_expected = (long long)(expected); \
+    const long long test_actual = (long long)(actual); \
+    if (test_expected != test_actual) { \
+      fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n", __FILE__, __LINE__, #actual, \
+              test_expected, test_actual); \
+      s_test_failures++; \
+    } \
+  } while (0)
+
+static inline int test_result(void) {
+  if (s_test_failures) {
+    fprintf(stderr, "%d assertion(s) failed\n", s_test_failures);
+    return 1;
+  }
+  return 0;
+}
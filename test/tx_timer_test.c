@@ -0,0 +1,173 @@
+/*
+ * Models the timer driven transmit in OneWireSoftSerial (_SS_TX_TIMER) at each baud rate, to check
+ * TX_TIMER_MIN_BIT_TICKS. The compare matches are exactly a bit apart, but each edge only happens
+ * once the ISR gets to write the pin, which can be held up by the instruction in progress and by
+ * another ISR (such as the Arduino timer 0 overflow). The edges are then received by a UART which
+ * samples the middle of each bit (edge_decoder.h) and whose clock is off by up to 2%. Every baud
+ * rate which is fast enough to use the timer must get every byte through, even with one edge of a
+ * byte as late as it can be and the rest as early as they can be.
+ */
+
+#include <string.h>
+
+#include "edge_decoder.h"
+#include "sim.h"
+#include "test.h"
+#include "tx_timer.h"
+
+#define F_CPU                   16000000
+// the cycles from the compare match to the pin being written when nothing else is running
+#define TX_ISR_CYCLES           23
+// the most cycles the ISR can be held up by the instruction in progress
+#define MAX_INSTRUCTION_CYCLES  4
+// the most cycles the ISR can be held up by another one which is already running
+#define MAX_OTHER_ISR_CYCLES    90
+// the most the receiver's clock is off by, in tenths of a percent
+#define MAX_RX_ERROR            20
+#define NUM_BYTES               200
+#define NUM_TRIALS              20
+
+typedef enum {
+  // each edge is held up by a random amount
+  LatencyRandom,
+  // the start bit is on time and one other edge is as late as it can be
+  LatencyLateEdge,
+  // the start bit is as late as it can be and the other edges are on time
+  LatencyLateStart
+} Latency;
+
+typedef struct {
+  uint32_t times[NUM_BYTES * EDGE_DECODER_NUM_BITS];
+  bool levels[NUM_BYTES * EDGE_DECODER_NUM_BITS];
+  size_t num_edges;
+  bool level;
+  uint32_t seed;
+} Line;
+
+static uint32_t prv_random(Line *line, uint32_t range) {
+  line->seed = line->seed * 1103515245 + 12345;
+  return (line->seed >> 16) % range;
+}
+
+static uint32_t prv_latency(Line *line, Latency latency, int bit, int late_bit) {
+  const uint32_t max_delay = MAX_INSTRUCTION_CYCLES + MAX_OTHER_ISR_CYCLES;
+  switch (latency) {
+  case LatencyRandom:
+    // the other ISR is only running some of the time
+    return TX_ISR_CYCLES + prv_random(line, MAX_INSTRUCTION_CYCLES + 1) +
+           (prv_random(line, 4) ? 0 : prv_random(line, MAX_OTHER_ISR_CYCLES + 1));
+  case LatencyLateEdge:
+    return TX_ISR_CYCLES + ((bit == late_bit) ? max_delay : 0);
+  case LatencyLateStart:
+    return TX_ISR_CYCLES + ((bit == 0) ? max_delay : 0);
+  default:
+    return TX_ISR_CYCLES;
+  }
+}
+
+// Sends the bytes back to back, the same way the TX ISR does from its queue.
+static void prv_send(Line *line, uint16_t bit_ticks, const uint8_t *data, size_t length,
+                     Latency latency) {
+  uint32_t compare = bit_ticks;
+  size_t i;
+  line->num_edges = 0;
+  line->level = true;
+  for (i = 0; i < length; i++) {
+    const int late_bit = 1 + prv_random(line, EDGE_DECODER_NUM_BITS - 1);
+    int bit;
+    for (bit = 0; bit < EDGE_DECODER_NUM_BITS; bit++) {
+      const bool level = (bit == 0) ? false :
+                         (bit == EDGE_DECODER_NUM_BITS - 1) ? true :
+                         ((data[i] >> (bit - 1)) & 1);
+      if (level != line->level) {
+        line->times[line->num_edges] = compare + prv_latency(line, latency, bit, late_bit);
+        line->levels[line->num_edges] = level;
+        line->num_edges++;
+        line->level = level;
+      }
+      compare += bit_ticks;
+    }
+  }
+}
+
+// Receives the edges with a clock which is off by the given tenths of a percent, and returns the
+// number of bytes received.
+static size_t prv_receive(const Line *line, uint32_t baud, int rx_error, uint8_t *received,
+                          size_t max_length) {
+  EdgeDecoder dec;
+  edge_decoder_init(&dec, EDGE_DECODER_BIT_TICKS(F_CPU, baud));
+  size_t length = 0;
+  uint8_t byte;
+  size_t i;
+  for (i = 0; i < line->num_edges; i++) {
+    const uint16_t time = (uint64_t)line->times[i] * (1000 + rx_error) / 1000;
+    if (dec.is_receiving &&
+        ((uint16_t)(time - dec.start_time) > EDGE_DECODER_STOP_TICKS(&dec)) &&
+        edge_decoder_timeout(&dec, &byte) && (length < max_length)) {
+      received[length++] = byte;
+    }
+    if (edge_decoder_handle_edge(&dec, time, line->levels[i], &byte) && (length < max_length)) {
+      received[length++] = byte;
+    }
+  }
+  if (edge_decoder_timeout(&dec, &byte) && (length < max_length)) {
+    received[length++] = byte;
+  }
+  return length;
+}
+
+// Returns true if every byte gets through at the given baud rate with the given bit length.
+static bool prv_check(uint32_t baud, uint16_t bit_ticks, Latency latency, int rx_error,
+                      uint32_t seed) {
+  static Line line;
+  uint8_t sent[NUM_BYTES];
+  uint8_t received[NUM_BYTES + 1];
+  size_t i;
+  line.seed = seed;
+  for (i = 0; i < NUM_BYTES; i++) {
+    sent[i] = prv_random(&line, 256);
+  }
+  prv_send(&line, bit_ticks, sent, NUM_BYTES, latency);
+  return (prv_receive(&line, baud, rx_error, received, sizeof(received)) == NUM_BYTES) &&
+         (memcmp(sent, received, NUM_BYTES) == 0);
+}
+
+static bool prv_check_all(uint32_t baud, uint16_t bit_ticks) {
+  const int rx_errors[] = { -MAX_RX_ERROR, 0, MAX_RX_ERROR };
+  bool success = true;
+  size_t i;
+  for (i = 0; i < sizeof(rx_errors) / sizeof(rx_errors[0]); i++) {
+    success &= prv_check(baud, bit_ticks, LatencyLateEdge, rx_errors[i], baud + i);
+    success &= prv_check(baud, bit_ticks, LatencyLateStart, rx_errors[i], baud + i);
+    int trial;
+    for (trial = 0; trial < NUM_TRIALS; trial++) {
+      success &= prv_check(baud, bit_ticks, LatencyRandom, rx_errors[i], baud * NUM_TRIALS + trial);
+    }
+  }
+  return success;
+}
+
+int main(void) {
+  int baud;
+  for (baud = 0; baud < PebbleBaudInvalid; baud++) {
+    // the same bit length as OneWireSoftSerial::begin() uses
+    const uint32_t rate = sim_baud_rate(baud);
+    const uint16_t bit_ticks = F_CPU / rate;
+    if (bit_ticks >= TX_TIMER_MIN_BIT_TICKS) {
+      if (!prv_check_all(rate, bit_ticks)) {
+        fprintf(stderr, "%lu baud uses the TX timer, but loses bytes\n", (unsigned long)rate);
+        TEST_ASSERT(false);
+      }
+    }
+  }
+
+  // the cutoff should leave some margin over the shortest bit which works, but not so much that
+  // the delay loops are used at baud rates where the timer would do
+  uint16_t bit_ticks = TX_TIMER_MIN_BIT_TICKS;
+  while (prv_check_all(F_CPU / bit_ticks, bit_ticks)) {
+    bit_ticks--;
+  }
+  TEST_ASSERT(bit_ticks < TX_TIMER_MIN_BIT_TICKS);
+  TEST_ASSERT(bit_ticks >= TX_TIMER_MIN_BIT_TICKS * 3 / 4);
+  return test_result();
+}
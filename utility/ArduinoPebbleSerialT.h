@@ -0,0 +1,290 @@
+#ifndef __ARDUINO_PEBBLE_SERIAL_T_H__
+#define __ARDUINO_PEBBLE_SERIAL_T_H__
+
+/*
+ * The implementation of ArduinoPebbleSerialT, which has to be in a header since it's a template.
+ * This is included from ArduinoPebbleSerial.h and shouldn't be included directly.
+ */
+
+template <typename Transport>
+uint8_t *ArduinoPebbleSerialT<Transport>::s_buffers[PEBBLE_MAX_RX_BUFFERS + 1];
+template <typename Transport>
+size_t ArduinoPebbleSerialT<Transport>::s_buffer_lengths[PEBBLE_MAX_RX_BUFFERS + 1];
+template <typename Transport> uint8_t ArduinoPebbleSerialT<Transport>::s_buffer_start;
+template <typename Transport> uint8_t ArduinoPebbleSerialT<Transport>::s_buffer_count;
+template <typename Transport> uint8_t *ArduinoPebbleSerialT<Transport>::s_held_buffer;
+template <typename Transport> size_t ArduinoPebbleSerialT<Transport>::s_held_length;
+template <typename Transport> uint8_t *ArduinoPebbleSerialT<Transport>::s_tx_buffer;
+#if PEBBLE_DEFAULT_TX_BUFFER_SIZE
+template <typename Transport>
+uint8_t ArduinoPebbleSerialT<Transport>::s_default_tx_buffer[PEBBLE_DEFAULT_TX_BUFFER_SIZE];
+#endif
+template <typename Transport> uint8_t ArduinoPebbleSerialT<Transport>::s_rx_chunk[32];
+template <typename Transport> uint8_t ArduinoPebbleSerialT<Transport>::s_rx_chunk_offset;
+template <typename Transport> uint8_t ArduinoPebbleSerialT<Transport>::s_rx_chunk_length;
+template <typename Transport> bool ArduinoPebbleSerialT<Transport>::s_tx_async;
+template <typename Transport> bool ArduinoPebbleSerialT<Transport>::s_decode_in_isr;
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::prv_cmd_cb(SmartstrapCmd cmd, uint32_t arg) {
+  switch (cmd) {
+  case SmartstrapCmdSetBaudRate:
+    Transport::begin(arg);
+    break;
+  case SmartstrapCmdSetTxEnabled:
+    Transport::set_tx_enabled(arg);
+    break;
+  case SmartstrapCmdWriteByte:
+    Transport::write((uint8_t)arg);
+    break;
+  case SmartstrapCmdWriteBuffer:
+    Transport::write(s_tx_buffer, arg);
+    if (s_tx_async) {
+      // the rest of the frame is written asynchronously, so this needs to be out first
+      Transport::flush();
+    }
+    break;
+  case SmartstrapCmdWriteBufferAsync:
+    Transport::write_async(s_tx_buffer, arg);
+    break;
+  case SmartstrapCmdWriteBreak:
+    Transport::write_break();
+    break;
+  default:
+    break;
+  }
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::begin(uint8_t *buffer, size_t length, Baud baud,
+                                            const uint16_t *services, uint8_t num_services) {
+  s_buffer_start = 0;
+  s_buffer_count = 0;
+  s_held_buffer = NULL;
+
+  pebble_init(prv_cmd_cb, (PebbleBaud)baud, services, num_services);
+  prv_prepare_for_read(buffer, length);
+#if PEBBLE_DEFAULT_TX_BUFFER_SIZE
+  set_tx_buffer(s_default_tx_buffer, sizeof(s_default_tx_buffer));
+#endif
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::prv_prepare_for_read(uint8_t *buffer, size_t length) {
+  bool success;
+  if (s_decode_in_isr) {
+    // the RX ISR may be picking a buffer for the next frame
+    noInterrupts();
+    success = pebble_prepare_for_read(buffer, length);
+    interrupts();
+  } else {
+    success = pebble_prepare_for_read(buffer, length);
+  }
+  if (success) {
+    // the library fills its buffers in order, so the next frame is always in the oldest one
+    const uint8_t index = (s_buffer_start + s_buffer_count) % (PEBBLE_MAX_RX_BUFFERS + 1);
+    s_buffers[index] = buffer;
+    s_buffer_lengths[index] = length;
+    s_buffer_count++;
+  }
+  return success;
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::add_buffer(uint8_t *buffer, size_t length) {
+  return prv_prepare_for_read(buffer, length);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::set_attributes(PebbleAttribute *attributes,
+                                                     uint8_t num_attributes) {
+  return pebble_set_attributes(attributes, num_attributes);
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::set_tx_buffer(uint8_t *buffer, size_t length) {
+  s_tx_buffer = buffer;
+  pebble_set_tx_buffer(buffer, length);
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::set_tx_async(bool enabled) {
+  s_tx_async = enabled && Transport::supports_async();
+  pebble_set_tx_async(s_tx_async);
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::prv_rx_isr_cb(uint8_t data) {
+  pebble_decode_byte(data);
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::set_decode_in_isr(bool enabled) {
+  if (!Transport::supports_rx_callback()) {
+    return;
+  }
+  s_decode_in_isr = enabled;
+  s_rx_chunk_offset = 0;
+  s_rx_chunk_length = 0;
+  Transport::set_rx_callback(enabled ? prv_rx_isr_cb : NULL);
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::set_stream_handler(PebbleStreamHandler handler) {
+  pebble_set_stream_handler(handler);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::prv_fill_rx_chunk(void) {
+  // move as many bytes as are available (up to the size of the chunk) out of the RX buffer
+  int available = Transport::available();
+  if (available > (int)sizeof(s_rx_chunk)) {
+    available = sizeof(s_rx_chunk);
+  }
+  s_rx_chunk_offset = 0;
+  s_rx_chunk_length = 0;
+  while (s_rx_chunk_length < available) {
+    s_rx_chunk[s_rx_chunk_length++] = Transport::read();
+  }
+  return s_rx_chunk_length > 0;
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::release(void) {
+  if (!s_held_buffer) {
+    return;
+  }
+  uint8_t *buffer = s_held_buffer;
+  s_held_buffer = NULL;
+  prv_prepare_for_read(buffer, s_held_length);
+}
+
+template <typename Transport>
+uint8_t *ArduinoPebbleSerialT<Transport>::get_payload(void) {
+  return s_held_buffer;
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::prv_frame_received(SmartstrapRequestType request_type,
+                                                         RequestType *type) {
+  // the sketch has the buffer until it calls feed() or release() again
+  s_held_buffer = s_buffers[s_buffer_start];
+  s_held_length = s_buffer_lengths[s_buffer_start];
+  s_buffer_start = (s_buffer_start + 1) % (PEBBLE_MAX_RX_BUFFERS + 1);
+  s_buffer_count--;
+  switch (request_type) {
+  case SmartstrapRequestTypeRead:
+    *type = RequestTypeRead;
+    break;
+  case SmartstrapRequestTypeWrite:
+    *type = RequestTypeWrite;
+    break;
+  case SmartstrapRequestTypeWriteRead:
+    *type = RequestTypeWriteRead;
+    break;
+  default:
+    break;
+  }
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::feed(uint16_t *service_id, uint16_t *attribute_id,
+                                           size_t *length, RequestType *type) {
+  SmartstrapRequestType request_type;
+  // the sketch is done with the last frame
+  release();
+  if (s_decode_in_isr) {
+    // At baud rates which are too fast for the RX callback, the transport still queues the bytes,
+    // so decode those here. Otherwise the frame has already been decoded by the RX ISR.
+    while (Transport::available()) {
+      const uint8_t data = Transport::read();
+      noInterrupts();
+      const bool is_ready = pebble_decode_byte(data);
+      interrupts();
+      if (is_ready) {
+        break;
+      }
+    }
+    if (pebble_handle_ready_frame(service_id, attribute_id, length, &request_type, millis())) {
+      prv_frame_received(request_type, type);
+      return true;
+    }
+    return false;
+  }
+
+  bool did_feed = false;
+  // any bytes left over in the chunk from the previous call are handled before reading more
+  while ((s_rx_chunk_offset < s_rx_chunk_length) || prv_fill_rx_chunk()) {
+    did_feed = true;
+    size_t consumed;
+    bool is_complete = pebble_handle_bytes(&s_rx_chunk[s_rx_chunk_offset],
+                                           s_rx_chunk_length - s_rx_chunk_offset, &consumed,
+                                           service_id, attribute_id, length, &request_type,
+                                           millis());
+    s_rx_chunk_offset += consumed;
+    if (is_complete) {
+      // we have a full frame
+      prv_frame_received(request_type, type);
+      return true;
+    }
+  }
+
+  if (!did_feed) {
+    // allow the pebble code to dicsonnect if we haven't gotten any messages recently
+    pebble_is_connected(millis());
+  }
+  return false;
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::write(bool success, const uint8_t *payload, size_t length) {
+  return pebble_write(success, payload, length);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::write_begin(bool success, uint16_t length) {
+  return pebble_write_begin(success, length);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::write_chunk(const uint8_t *data, uint16_t length) {
+  return pebble_write_chunk(data, length);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::write_end(void) {
+  return pebble_write_end();
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::write_compressed(bool success, const uint8_t *payload,
+                                                       size_t length) {
+  return pebble_write_compressed(success, payload, length);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::notify(uint16_t service_id, uint16_t attribute_id) {
+  return pebble_notify(service_id, attribute_id, millis());
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::set_notify_interval(uint16_t interval_ms) {
+  pebble_set_notify_interval(interval_ms);
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::is_connected(void) {
+  return pebble_is_connected(millis());
+}
+
+template <typename Transport>
+bool ArduinoPebbleSerialT<Transport>::is_tx_busy(void) {
+  return pebble_is_tx_busy();
+}
+
+template <typename Transport>
+void ArduinoPebbleSerialT<Transport>::get_drop_counters(PebbleDropCounters *counters) {
+  pebble_get_drop_counters(counters);
+}
+
+#endif // __ARDUINO_PEBBLE_SERIAL_T_H__
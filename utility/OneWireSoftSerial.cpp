@@ -23,21 +23,58 @@ void OneWireSoftSerial::begin(uint8_t pin, long speed) { }
 int OneWireSoftSerial::available(void) { return 0; }
 void OneWireSoftSerial::set_tx_enabled(bool enabled) { }
 void OneWireSoftSerial::write(uint8_t byte, bool is_break) { }
+void OneWireSoftSerial::write(const uint8_t *buffer, size_t length) { }
+void OneWireSoftSerial::write_async(const uint8_t *buffer, size_t length, void (*done)(void)) {
+  done();
+}
 int OneWireSoftSerial::read(void) { return -1; };
+void OneWireSoftSerial::set_rx_callback(void (*callback)(uint8_t data)) { }
+uint16_t OneWireSoftSerial::get_rx_overflow_count(void) { return 0; }
+uint8_t OneWireSoftSerial::get_rx_high_water_mark(void) { return 0; }
 
 #else
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <Arduino.h>
 #include <util/delay_basic.h>
+#if _SS_TX_TIMER
+// TX_TIMER_MIN_BIT_TICKS, which is checked against a model of the ISR timing by test/tx_timer_test.c
+#include "tx_timer.h"
+#endif
+#if _SS_RX_INPUT_CAPTURE
+#include "edge_decoder.h"
+
+// The ICP1 pin is checked by its port and bit, since its Arduino pin number depends on the board
+// as well as the chip (PD4 is pin 4 on the Leonardo, but pin 22 on the Teensy 2.0).
+#if defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
+#define ICP_INPUT_REGISTER PINB
+#define ICP_BIT_MASK _BV(0)
+#elif defined(__AVR_ATmega32U4__)
+#define ICP_INPUT_REGISTER PIND
+#define ICP_BIT_MASK _BV(4)
+#else
+#error "_SS_RX_INPUT_CAPTURE is not supported on this board"
+#endif
+#endif
 
 
 // Statics
 ////////////////////////////////////////////////////////////////////////////////
 
+static_assert((_SS_MAX_RX_BUFF & (_SS_MAX_RX_BUFF - 1)) == 0,
+              "_SS_MAX_RX_BUFF must be a power of 2");
+static_assert(_SS_MAX_RX_BUFF <= 256, "_SS_MAX_RX_BUFF must fit in a uint8_t index");
+#define RX_BUFF_MASK (_SS_MAX_RX_BUFF - 1)
+
 static char s_receive_buffer[_SS_MAX_RX_BUFF];
 static volatile uint8_t s_receive_buffer_tail = 0;
 static volatile uint8_t s_receive_buffer_head = 0;
+static volatile uint16_t s_receive_overflow_count = 0;
+static volatile uint8_t s_receive_high_water_mark = 0;
+static void (*s_rx_callback)(uint8_t data) = 0;
+// s_rx_callback if the baud rate leaves time for it, which is what the RX ISR uses
+static void (*volatile s_rx_callback_active)(uint8_t data) = 0;
+static bool s_rx_callback_allowed = false;
 static uint16_t s_rx_delay_centering = 0;
 static uint16_t s_rx_delay_intrabit = 0;
 static uint16_t s_rx_delay_stopbit = 0;
@@ -48,7 +85,26 @@ static volatile uint8_t *s_port_output_register = 0;
 static volatile uint8_t *s_port_input_register = 0;
 static volatile uint8_t *s_pcint_mask_reg = 0;
 static uint8_t s_pcint_mask_value = 0;
-static bool s_tx_enabled = false;
+static volatile bool s_tx_enabled = false;
+#if _SS_RX_INPUT_CAPTURE
+static EdgeDecoder s_edge_decoder;
+#endif
+#if _SS_TX_TIMER
+#define TX_QUEUE_SIZE 8
+#define TX_QUEUE_MASK (TX_QUEUE_SIZE - 1)
+// The TX queue holds whole frames: the start bit, data bits and stop bit, LSB first, followed by a
+// marker bit so the ISR knows when the stop bit has been sent.
+static uint16_t s_tx_queue[TX_QUEUE_SIZE];
+static volatile uint8_t s_tx_queue_head = 0;
+static volatile uint8_t s_tx_queue_tail = 0;
+static const uint8_t *volatile s_tx_async_data = 0;
+static volatile size_t s_tx_async_length = 0;
+static void (*volatile s_tx_async_done)(void) = 0;
+static uint16_t s_tx_frame = 0;
+static uint16_t s_bit_ticks = 0;
+static bool s_tx_use_timer = false;
+static volatile bool s_tx_busy = false;
+#endif
 
 
 // Helper macros
@@ -62,11 +118,51 @@ static bool s_tx_enabled = false;
 ////////////////////////////////////////////////////////////////////////////////
 
 static inline void prv_set_rx_int_msk(bool enable) {
+#if _SS_RX_INPUT_CAPTURE
+  if (enable) {
+    // any edges while we were transmitting were our own, so start looking for a start bit again
+    edge_decoder_reset(&s_edge_decoder);
+    bitClear(TCCR1B, ICES1);
+    TIFR1 = _BV(ICF1) | _BV(OCF1A);
+    bitSet(TIMSK1, ICIE1);
+  } else {
+    TIMSK1 &= ~(_BV(ICIE1) | _BV(OCIE1A));
+  }
+#else
   if (enable) {
     *s_pcint_mask_reg |= s_pcint_mask_value;
   } else {
     *s_pcint_mask_reg &= ~s_pcint_mask_value;
   }
+#endif
+}
+
+static inline void prv_push_byte(uint8_t d) {
+  void (*callback)(uint8_t data) = s_rx_callback_active;
+  if (callback) {
+    callback(d);
+    return;
+  }
+  const uint8_t next = (s_receive_buffer_tail + 1) & RX_BUFF_MASK;
+  if (next != s_receive_buffer_head) {
+    // save new data in buffer: tail points to where byte goes
+    s_receive_buffer[s_receive_buffer_tail] = d; // save new byte
+    s_receive_buffer_tail = next;
+    const uint8_t level = (next - s_receive_buffer_head) & RX_BUFF_MASK;
+    if (level > s_receive_high_water_mark) {
+      s_receive_high_water_mark = level;
+    }
+  } else {
+    s_receive_overflow_count++;
+  }
+}
+
+static void prv_update_rx_callback(void) {
+  // pointer writes aren't atomic
+  uint8_t old_sreg = SREG;
+  cli();
+  s_rx_callback_active = s_rx_callback_allowed ? s_rx_callback : 0;
+  SREG = old_sreg;
 }
 
 static inline void prv_set_tx_enabled(bool enabled) {
@@ -80,6 +176,42 @@ static inline void prv_set_tx_enabled(bool enabled) {
   }
 }
 
+#if _SS_TX_TIMER
+static inline uint16_t prv_tx_frame(uint8_t b, bool is_break) {
+  if (is_break) {
+    // a start bit, 9 zero bits, and then the stop bit
+    return _BV(11) | _BV(10);
+  }
+  return _BV(10) | _BV(9) | ((uint16_t)b << 1);
+}
+
+// Returns the next frame to send, or 0 if there isn't one. Must be called with interrupts disabled.
+static inline uint16_t prv_next_tx_frame(void) {
+  if (s_tx_queue_head != s_tx_queue_tail) {
+    const uint16_t frame = s_tx_queue[s_tx_queue_head];
+    s_tx_queue_head = (s_tx_queue_head + 1) & TX_QUEUE_MASK;
+    return frame;
+  } else if (s_tx_async_length) {
+    s_tx_async_length--;
+    return prv_tx_frame(*s_tx_async_data++, false);
+  }
+  return 0;
+}
+
+// Starts the TX ISR if it's not already running. Must be called with interrupts disabled.
+static inline void prv_start_tx(void) {
+  if (s_tx_busy) {
+    return;
+  }
+  s_tx_busy = true;
+  s_tx_frame = prv_next_tx_frame();
+  // the first bit goes out a bit from now (which also makes sure the line has been idle that long)
+  OCR1B = TCNT1 + s_bit_ticks;
+  TIFR1 = _BV(OCF1B);
+  bitSet(TIMSK1, OCIE1B);
+}
+#endif
+
 // The receive routine called by the interrupt handler
 static inline void prv_recv(void) {
 #if !defined(__arm__) && GCC_VERSION < 40302
@@ -120,18 +252,16 @@ static inline void prv_recv(void) {
       }
     }
 
-    const uint8_t next = (s_receive_buffer_tail + 1) % _SS_MAX_RX_BUFF;
-    if (next != s_receive_buffer_head) {
-      // save new data in buffer: tail points to where byte goes
-      s_receive_buffer[s_receive_buffer_tail] = d; // save new byte
-      s_receive_buffer_tail = next;
-    }
-
     // skip the stop bit
     TUNED_DELAY(s_rx_delay_stopbit);
 
     // Re-enable interrupts when we're sure to be inside the stop bit
     prv_set_rx_int_msk(true);
+
+    // The byte is handed over last, so that an RX callback can't push the end of the stop bit
+    // delay past the next start bit. The next start bit sets the interrupt flag while the callback
+    // runs, and begin() only allows the callback if it finishes in time for that to be handled.
+    prv_push_byte(d);
   }
 
 #if !defined(__arm__) && GCC_VERSION < 40302
@@ -154,6 +284,67 @@ static inline void prv_recv(void) {
 // Interrupt handling
 ////////////////////////////////////////////////////////////////////////////////
 
+#if _SS_TX_TIMER
+ISR(TIMER1_COMPB_vect) {
+  if (!s_tx_frame) {
+    // the last stop bit has been sent
+    bitClear(TIMSK1, OCIE1B);
+    s_tx_busy = false;
+    void (*done)(void) = s_tx_async_done;
+    if (done) {
+      s_tx_async_done = 0;
+      prv_set_tx_enabled(false);
+      prv_set_rx_int_msk(true);
+      s_tx_enabled = false;
+      done();
+    }
+    return;
+  }
+
+  // write the next bit first so the edge is as close to the compare match as possible
+  if (s_tx_frame & 1) {
+    *s_port_output_register |= s_bit_mask;
+  } else {
+    *s_port_output_register &= ~s_bit_mask;
+  }
+  OCR1B += s_bit_ticks;
+  s_tx_frame >>= 1;
+  if (s_tx_frame == 1) {
+    // that was the stop bit, so get the next frame ready
+    s_tx_frame = prv_next_tx_frame();
+  }
+}
+#endif
+
+#if _SS_RX_INPUT_CAPTURE
+ISR(TIMER1_CAPT_vect) {
+  const uint16_t time = ICR1;
+  // this capture was for the edge selected by ICES1, so look for the opposite edge next (which can
+  // set the capture flag again)
+  const bool level = bit_is_set(TCCR1B, ICES1);
+  TCCR1B ^= _BV(ICES1);
+  TIFR1 = _BV(ICF1);
+
+  uint8_t d;
+  if (edge_decoder_handle_edge(&s_edge_decoder, time, level, &d)) {
+    prv_push_byte(d);
+  }
+  if (s_edge_decoder.is_receiving) {
+    // finish the byte in the middle of the stop bit if there are no more edges before then
+    OCR1A = s_edge_decoder.start_time + EDGE_DECODER_STOP_TICKS(&s_edge_decoder);
+    TIFR1 = _BV(OCF1A);
+    bitSet(TIMSK1, OCIE1A);
+  }
+}
+
+ISR(TIMER1_COMPA_vect) {
+  bitClear(TIMSK1, OCIE1A);
+  uint8_t d;
+  if (edge_decoder_timeout(&s_edge_decoder, &d)) {
+    prv_push_byte(d);
+  }
+}
+#else
 #if defined(PCINT0_vect)
 ISR(PCINT0_vect) {
   prv_recv();
@@ -171,6 +362,7 @@ ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
 #if defined(PCINT3_vect)
 ISR(PCINT3_vect, ISR_ALIASOF(PCINT0_vect));
 #endif
+#endif // _SS_RX_INPUT_CAPTURE
 
 
 // Public methods
@@ -181,9 +373,15 @@ void OneWireSoftSerial::begin(uint8_t pin, long speed) {
   s_bit_mask = digitalPinToBitMask(s_pin);
   s_port_output_register = portOutputRegister(digitalPinToPort(s_pin));
   s_port_input_register = portInputRegister(digitalPinToPort(s_pin));
+#if _SS_RX_INPUT_CAPTURE
+  if ((s_port_input_register != &ICP_INPUT_REGISTER) || (s_bit_mask != ICP_BIT_MASK)) {
+    return;
+  }
+#else
   if (!digitalPinToPCICR(s_pin)) {
     return;
   }
+#endif
   pinMode(2, OUTPUT);
 
   s_rx_delay_centering = s_rx_delay_intrabit = s_rx_delay_stopbit = s_tx_delay = 0;
@@ -236,6 +434,30 @@ void OneWireSoftSerial::begin(uint8_t pin, long speed) {
   #endif
 
 
+#if _SS_RX_INPUT_CAPTURE || _SS_TX_TIMER
+  // Run timer 1 from the CPU clock. This is also used to timestamp edges on the ICP1 pin (with the
+  // noise canceler on) and to time TX bits.
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+#endif
+#if _SS_TX_TIMER
+  s_bit_ticks = F_CPU / speed;
+  s_tx_use_timer = s_bit_ticks >= TX_TIMER_MIN_BIT_TICKS;
+#endif
+#if _SS_RX_INPUT_CAPTURE
+  // The edges are timestamped by the hardware, so the callback just has to be done before the
+  // edge after next overwrites the capture, which is at least a bit away.
+  s_rx_callback_allowed = (F_CPU / speed) >= _SS_RX_CALLBACK_CYCLES;
+#else
+  // The callback runs from a quarter of the way into the stop bit, and has to be done by the time
+  // the next start bit begins, or the ISR for it is late and samples the bits off center.
+  s_rx_callback_allowed = (F_CPU / speed) * 3 / 4 >= _SS_RX_CALLBACK_CYCLES;
+#endif
+  prv_update_rx_callback();
+#if _SS_RX_INPUT_CAPTURE
+  bitSet(TCCR1B, ICNC1);
+  edge_decoder_init(&s_edge_decoder, EDGE_DECODER_BIT_TICKS(F_CPU, speed));
+#else
   // Enable the PCINT for the entire port here, but never disable it
   // (others might also need it, so we disable the interrupt by using
   // the per-pin PCMSK register).
@@ -244,6 +466,7 @@ void OneWireSoftSerial::begin(uint8_t pin, long speed) {
   // can be used inside the ISR without costing too much time.
   s_pcint_mask_reg = digitalPinToPCMSK(s_pin);
   s_pcint_mask_value = _BV(digitalPinToPCMSKbit(s_pin));
+#endif
 
   TUNED_DELAY(s_tx_delay); // if we were low this establishes the end
 
@@ -261,12 +484,30 @@ int OneWireSoftSerial::read() {
 
   // Read from "head"
   uint8_t d = s_receive_buffer[s_receive_buffer_head]; // grab next byte
-  s_receive_buffer_head = (s_receive_buffer_head + 1) % _SS_MAX_RX_BUFF;
+  s_receive_buffer_head = (s_receive_buffer_head + 1) & RX_BUFF_MASK;
   return d;
 }
 
+void OneWireSoftSerial::set_rx_callback(void (*callback)(uint8_t data)) {
+  s_rx_callback = callback;
+  prv_update_rx_callback();
+}
+
 int OneWireSoftSerial::available() {
-  return (s_receive_buffer_tail + _SS_MAX_RX_BUFF - s_receive_buffer_head) % _SS_MAX_RX_BUFF;
+  return (s_receive_buffer_tail - s_receive_buffer_head) & RX_BUFF_MASK;
+}
+
+uint16_t OneWireSoftSerial::get_rx_overflow_count() {
+  // this is updated from the ISR and can't be read atomically
+  uint8_t old_sreg = SREG;
+  cli();
+  uint16_t count = s_receive_overflow_count;
+  SREG = old_sreg;
+  return count;
+}
+
+uint8_t OneWireSoftSerial::get_rx_high_water_mark() {
+  return s_receive_high_water_mark;
 }
 
 void OneWireSoftSerial::set_tx_enabled(bool enabled) {
@@ -274,6 +515,22 @@ void OneWireSoftSerial::set_tx_enabled(bool enabled) {
     return;
   }
   static uint8_t s_old_sreg = 0;
+#if _SS_TX_TIMER
+  if (s_tx_use_timer) {
+    // interrupts stay enabled; we just need to wait for the last stop bit before turning around
+    if (enabled) {
+      prv_set_rx_int_msk(false);
+      prv_set_tx_enabled(true);
+    } else {
+      while (s_tx_busy) {
+      }
+      prv_set_tx_enabled(false);
+      prv_set_rx_int_msk(true);
+    }
+    s_tx_enabled = enabled;
+    return;
+  }
+#endif
   if (enabled) {
     s_old_sreg = SREG;
     cli();
@@ -292,6 +549,23 @@ void OneWireSoftSerial::write(uint8_t b, bool is_break /* = false */) {
     return;
   }
 
+#if _SS_TX_TIMER
+  if (s_tx_use_timer) {
+    const uint16_t frame = prv_tx_frame(b, is_break);
+    const uint8_t next = (s_tx_queue_tail + 1) & TX_QUEUE_MASK;
+    while (next == s_tx_queue_head) {
+      // wait for the ISR to make space in the queue
+    }
+    uint8_t old_sreg = SREG;
+    cli();
+    s_tx_queue[s_tx_queue_tail] = frame;
+    s_tx_queue_tail = next;
+    prv_start_tx();
+    SREG = old_sreg;
+    return;
+  }
+#endif
+
   // By declaring these as local variables, the compiler will put them
   // in registers _before_ disabling interrupts and entering the
   // critical timing sections below, which makes it a lot easier to
@@ -322,4 +596,37 @@ void OneWireSoftSerial::write(uint8_t b, bool is_break /* = false */) {
   *reg |= reg_mask;
   TUNED_DELAY(s_tx_delay);
 }
+
+void OneWireSoftSerial::write(const uint8_t *buffer, size_t length) {
+  if (!s_tx_enabled) {
+    return;
+  }
+
+  for (size_t i = 0; i < length; ++i) {
+    write(buffer[i]);
+  }
+}
+void OneWireSoftSerial::write_async(const uint8_t *buffer, size_t length, void (*done)(void)) {
+  if (!s_tx_enabled) {
+    // nothing can be sent, but the caller is still waiting to hear that the write is over
+    done();
+    return;
+  }
+
+#if _SS_TX_TIMER
+  if (s_tx_use_timer) {
+    uint8_t old_sreg = SREG;
+    cli();
+    s_tx_async_data = buffer;
+    s_tx_async_length = length;
+    s_tx_async_done = done;
+    prv_start_tx();
+    SREG = old_sreg;
+    return;
+  }
+#endif
+  write(buffer, length);
+  set_tx_enabled(false);
+  done();
+}
 #endif // __arm__
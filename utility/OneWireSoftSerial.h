@@ -20,6 +20,7 @@
 #define __SOFT_SERIAL_H__
 
 #include <inttypes.h>
+#include <stddef.h>
 
 #if ARDUINO > 1000
 #define STATIC_ASSERT_VALID_ONE_WIRE_SOFT_SERIAL_PIN(pin) \
@@ -27,7 +28,28 @@
 #else
 #define STATIC_ASSERT_VALID_ONE_WIRE_SOFT_SERIAL_PIN(pin)
 #endif
-#define _SS_MAX_RX_BUFF 64 // RX buffer size
+// Set to 1 to receive using timer 1's input capture rather than a pin change interrupt and delay
+// loops. This takes much less CPU time per byte and works at higher baud rates, but the pin must be
+// the ICP1 pin (8 on the Uno, 4 on the Leonardo, 22 on the Teensy 2.0) and timer 1 can't be used
+// for anything else.
+#ifndef _SS_RX_INPUT_CAPTURE
+#define _SS_RX_INPUT_CAPTURE 0
+#endif
+// Set to 1 to transmit from a timer 1 compare interrupt (one bit per interrupt) rather than with
+// interrupts disabled and delay loops for the whole write. This is only used at baud rates which
+// leave enough time between bits for the interrupt (up to 38400 at 16MHz); faster baud rates still
+// use delay loops.
+#ifndef _SS_TX_TIMER
+#define _SS_TX_TIMER 0
+#endif
+// The most cycles which the RX callback (see set_rx_callback()) can take. The callback is only used
+// at baud rates which leave this long after each byte before it would delay the next one.
+#ifndef _SS_RX_CALLBACK_CYCLES
+#define _SS_RX_CALLBACK_CYCLES 400
+#endif
+#ifndef _SS_MAX_RX_BUFF
+#define _SS_MAX_RX_BUFF 64 // RX buffer size (must be a power of two, up to 256)
+#endif
 
 class OneWireSoftSerial
 {
@@ -37,7 +59,20 @@ public:
   static int available();
   static void set_tx_enabled(bool enabled);
   static void write(uint8_t byte, bool is_break = false);
+  static void write(const uint8_t *buffer, size_t length);
+  // Writes the buffer without waiting for it to be sent. Once the last byte is out, TX is disabled
+  // and done() is called (from an ISR when transmitting from a timer). If TX isn't enabled, nothing
+  // is sent and done() is called straight away.
+  static void write_async(const uint8_t *buffer, size_t length, void (*done)(void));
   static int read();
+  // Passes each received byte to callback (from the RX ISR) instead of putting it in the RX buffer.
+  // This only happens at baud rates which leave time for _SS_RX_CALLBACK_CYCLES after each byte; at
+  // faster ones, the bytes still go into the RX buffer, so read() has to be polled either way.
+  static void set_rx_callback(void (*callback)(uint8_t data));
+  // the number of bytes dropped because the RX buffer was full
+  static uint16_t get_rx_overflow_count();
+  // the most bytes which have been waiting in the RX buffer at once
+  static uint8_t get_rx_high_water_mark();
 };
 
 #endif
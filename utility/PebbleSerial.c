@@ -2,278 +2,867 @@
 
 #include "PebbleSerial.h"
 
+#include <string.h>
+
 #include "crc.h"
+#include "delta.h"
 #include "encoding.h"
-#include "board.h"
-
-#define PROTOCOL_VERSION              1
-#define GENERIC_SERVICE_VERSION       1
-
-#define FRAME_MIN_LENGTH              8
-#define FRAME_VERSION_OFFSET          0
-#define FRAME_FLAGS_OFFSET            1
-#define FRAME_PROFILE_OFFSET          5
-#define FRAME_PAYLOAD_OFFSET          7
-
-#define FLAGS_IS_READ_OFFSET          0
-#define FLAGS_IS_MASTER_OFFSET        1
-#define FLAGS_IS_NOTIFICATION_OFFSET  2
-#define FLAGS_RESERVED_OFFSET         3
-#define FLAGS_IS_READ_MASK            (0x1 << FLAGS_IS_READ_OFFSET)
-#define FLAGS_IS_MASTER_MASK          (0x1 << FLAGS_IS_MASTER_OFFSET)
-#define FLAGS_IS_NOTIFICATION_MASK    (0x1 << FLAGS_IS_NOTIFICATION_OFFSET)
-#define FLAGS_RESERVED_MASK           (~(FLAGS_IS_READ_MASK | \
-                                         FLAGS_IS_MASTER_MASK | \
-                                         FLAGS_IS_NOTIFICATION_MASK))
-#define FLAGS_GET(flags, mask, offset) (((flags) & mask) >> offset)
-#define FLAGS_SET(flags, mask, offset, value) \
-  (flags) = ((flags) & ~mask) | (((value) << offset) & mask)
-
-typedef enum {
-  SmartstrapProfileInvalid = 0x00,
-  SmartstrapProfileLinkControl = 0x01,
-  SmartstrapProfileRawData = 0x02,
-  SmartstrapProfileGenericService = 0x03,
-  NumSmartstrapProfiles
-} SmartstrapProfile;
-
-typedef enum {
-  LinkControlTypeInvalid = 0,
-  LinkControlTypeStatus = 1,
-  LinkControlTypeProfiles = 2,
-  LinkControlTypeBaud = 3,
-  NumLinkControlTypes
-} LinkControlType;
-
-typedef enum {
-  LinkControlStatusOk = 0,
-  LinkControlStatusBaudRate = 1,
-  LinkControlStatusDisconnect = 2
-} LinkControlStatus;
-
-typedef struct {
-  uint8_t version;
-  uint32_t flags;
-  uint16_t profile;
-} FrameHeader;
-
-typedef struct {
-  FrameHeader header;
-  uint8_t *payload;
-  uint8_t checksum;
-  size_t length;
-  size_t max_payload_length;
-  uint8_t footer_byte;
-  bool should_drop;
-  bool read_ready;
-  bool is_read;
-  EncodingStreamingContext encoding_ctx;
-} PebbleFrameInfo;
-
-typedef struct __attribute__((packed)) {
-  uint8_t version;
-  uint16_t service_id;
-  uint16_t attribute_id;
-  uint8_t type;
-  uint8_t error;
-  uint16_t length;
-  uint8_t data[];
-} GenericServicePayload;
-
-static SmartstrapRequestType s_last_generic_service_type;
-static uint32_t s_last_message_time = 0;
-static PebbleFrameInfo s_frame;
-static SmartstrapCallback s_callback;
-static bool s_connected;
-static PebbleBaud s_current_baud = PebbleBaudInvalid;
-static PebbleBaud s_target_baud = PebbleBaudInvalid;
-static const uint32_t BAUDS[] = { 9600, 14400, 19200, 28800, 38400, 57600, 67500, 115200, 125000,
+#include "lz.h"
+#include "SmartstrapProtocol.h"
+
+#define VALUE_READ_ATTEMPTS           4
+// how long to wait for the watch to read the notification info before giving up on a notification
+#define NOTIFICATION_TIMEOUT_MS       1000
+
+static const uint32_t BAUDS[] = { 9600, 14400, 19200, 28800, 38400, 57600, 62500, 115200, 125000,
                                   230400, 250000, 460800 };
-static uint16_t s_notify_service;
-static uint16_t s_notify_attribute;
-static const uint16_t *s_supported_services;
-static uint8_t s_num_supported_services;
-static struct {
-  bool can_respond;
-  uint16_t service_id;
-  uint16_t attribute_id;
-} s_pending_response;
-
-
-void prv_set_baud(PebbleBaud baud) {
-  if (baud == s_current_baud) {
+
+static PebbleSerialContext s_default_ctx;
+static SmartstrapCallback s_default_callback;
+
+static inline void prv_send_cmd(PebbleSerialContext *ctx, SmartstrapCmd cmd, uint32_t arg) {
+  // wait for any async write to finish, since it's still using the TX buffer and the line
+  while (ctx->tx_buffer.is_busy) {
+  }
+  ctx->callback(ctx->callback_context, cmd, arg);
+}
+
+static void prv_set_baud(PebbleSerialContext *ctx, PebbleBaud baud) {
+  if (baud == ctx->current_baud) {
     return;
   }
-  s_current_baud = baud;
-  s_callback(SmartstrapCmdSetBaudRate, BAUDS[baud]);
-  s_callback(SmartstrapCmdSetTxEnabled, true);
-  s_callback(SmartstrapCmdSetTxEnabled, false);
+  ctx->current_baud = baud;
+  prv_send_cmd(ctx, SmartstrapCmdSetBaudRate, BAUDS[baud]);
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, true);
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, false);
 }
 
-void pebble_init(SmartstrapCallback callback, PebbleBaud baud, const uint16_t *services,
-                 uint8_t num_services) {
-  s_callback = callback;
-  s_target_baud = baud;
-  s_supported_services = services;
-  s_num_supported_services = num_services;
-  prv_set_baud(PebbleBaud9600);
-}
-
-void pebble_prepare_for_read(uint8_t *buffer, size_t length) {
-  s_frame = (PebbleFrameInfo) {
-    .payload = buffer,
-    .max_payload_length = length,
-    .read_ready = true
+void pebble_ctx_init(PebbleSerialContext *ctx, SmartstrapContextCallback callback,
+                     void *callback_context, PebbleBaud baud, const uint16_t *services,
+                     uint8_t num_services) {
+  *ctx = (PebbleSerialContext) {
+    .callback = callback,
+    .callback_context = callback_context,
+    .current_baud = PebbleBaudInvalid,
+    .target_baud = baud,
+    .supported_services = services,
+    .num_supported_services = num_services
   };
+  prv_set_baud(ctx, PebbleBaud9600);
 }
 
-static void prv_send_flag(void) {
-  s_callback(SmartstrapCmdWriteByte, ENCODING_FLAG);
+static void prv_reset_frame(PebbleSerialContext *ctx) {
+  // the payload buffer is picked once we know the profile of the next frame
+  ctx->frame = (PebbleFrameInfo) {
+    .payload = NULL
+  };
 }
 
-static void prv_send_byte(uint8_t data, uint8_t *parity) {
-  crc8_calculate_byte_streaming(data, parity);
-  if (encoding_encode(&data)) {
-    s_callback(SmartstrapCmdWriteByte, ENCODING_ESCAPE);
+static void prv_next_rx_buffer(PebbleSerialContext *ctx) {
+  // the current buffer now belongs to the application, so move on to the next queued one
+  if (ctx->rx_buffers.count == 0) {
+    // nowhere to put the next frame until the application hands a buffer back
+    ctx->rx_buffers.current = NULL;
+    return;
   }
-  s_callback(SmartstrapCmdWriteByte, data);
+  const uint8_t index = ctx->rx_buffers.start;
+  ctx->rx_buffers.start = (index + 1) % PEBBLE_MAX_RX_BUFFERS;
+  ctx->rx_buffers.count--;
+  ctx->rx_buffers.current = ctx->rx_buffers.buffers[index];
+  ctx->rx_buffers.current_length = ctx->rx_buffers.lengths[index];
 }
 
-static void prv_write_internal(SmartstrapProfile profile, const uint8_t *data1, size_t length1,
-                               const uint8_t *data2, size_t length2, bool is_notify) {
-  uint8_t parity = 0;
+// Returns the longest value which has to be copied into a payload buffer before it's sent, since it
+// can be updated while it's being read.
+static size_t prv_max_guarded_value_length(const PebbleAttribute *attributes,
+                                           uint8_t num_attributes) {
+  size_t max_length = 0;
+  uint8_t i;
+  for (i = 0; i < num_attributes; i++) {
+    if (attributes[i].value && attributes[i].sequence && (attributes[i].max_length > max_length)) {
+      max_length = attributes[i].max_length;
+    }
+  }
+  return max_length;
+}
 
-  // enable tx
-  s_callback(SmartstrapCmdSetTxEnabled, true);
+static bool prv_has_rx_buffer(PebbleSerialContext *ctx, const uint8_t *buffer) {
+  uint8_t i;
+  if (ctx->rx_buffers.current == buffer) {
+    return true;
+  }
+  for (i = 0; i < ctx->rx_buffers.count; i++) {
+    if (ctx->rx_buffers.buffers[(ctx->rx_buffers.start + i) % PEBBLE_MAX_RX_BUFFERS] == buffer) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  // send flag
-  prv_send_flag();
+bool pebble_ctx_prepare_for_read(PebbleSerialContext *ctx, uint8_t *buffer, size_t length) {
+  if (length < prv_max_guarded_value_length(ctx->attributes, ctx->num_attributes)) {
+    return false;
+  }
+  if (prv_has_rx_buffer(ctx, buffer)) {
+    // a buffer handed over twice would have two frames received into it at once
+    return false;
+  }
+  if (!ctx->rx_buffers.current) {
+    // we don't have a buffer, so start using this one straight away
+    ctx->rx_buffers.current = buffer;
+    ctx->rx_buffers.current_length = length;
+    return true;
+  } else if (ctx->rx_buffers.count == PEBBLE_MAX_RX_BUFFERS) {
+    return false;
+  }
+  const uint8_t index = (ctx->rx_buffers.start + ctx->rx_buffers.count) % PEBBLE_MAX_RX_BUFFERS;
+  ctx->rx_buffers.buffers[index] = buffer;
+  ctx->rx_buffers.lengths[index] = length;
+  ctx->rx_buffers.count++;
+  return true;
+}
 
-  // send version
-  prv_send_byte(PROTOCOL_VERSION, &parity);
+static inline uint32_t prv_attribute_key(uint16_t service_id, uint16_t attribute_id) {
+  return ((uint32_t)service_id << 16) | attribute_id;
+}
 
-  // send header flags (currently just hard-coded)
-  if (is_notify) {
-    prv_send_byte(0x04, &parity);
-  } else {
-    prv_send_byte(0, &parity);
+bool pebble_ctx_set_attributes(PebbleSerialContext *ctx, PebbleAttribute *attributes,
+                               uint8_t num_attributes) {
+  // every payload buffer which has been handed over has to be able to hold the guarded values
+  const size_t max_length = prv_max_guarded_value_length(attributes, num_attributes);
+  uint8_t i;
+  if (ctx->rx_buffers.current && (ctx->rx_buffers.current_length < max_length)) {
+    return false;
   }
-  prv_send_byte(0, &parity);
-  prv_send_byte(0, &parity);
-  prv_send_byte(0, &parity);
+  for (i = 0; i < ctx->rx_buffers.count; i++) {
+    if (ctx->rx_buffers.lengths[(ctx->rx_buffers.start + i) % PEBBLE_MAX_RX_BUFFERS] < max_length) {
+      return false;
+    }
+  }
+
+  // sort the attributes by service and then attribute so they can be binary searched
+  for (i = 1; i < num_attributes; i++) {
+    const PebbleAttribute attribute = attributes[i];
+    const uint32_t key = prv_attribute_key(attribute.service_id, attribute.attribute_id);
+    uint8_t j;
+    for (j = i; j > 0; j--) {
+      const PebbleAttribute *prev = &attributes[j - 1];
+      if (prv_attribute_key(prev->service_id, prev->attribute_id) <= key) {
+        break;
+      }
+      attributes[j] = *prev;
+    }
+    attributes[j] = attribute;
+  }
+  ctx->attributes = attributes;
+  ctx->num_attributes = num_attributes;
+  return true;
+}
 
-  // send profile (currently well within a single byte)
-  prv_send_byte(profile, &parity);
-  prv_send_byte(0, &parity);
+void pebble_ctx_set_stream_handler(PebbleSerialContext *ctx, PebbleStreamHandler handler) {
+  ctx->stream_handler = handler;
+}
 
-  // send data
-  size_t i;
-  for (i = 0; i < length1; ++i) {
-    prv_send_byte(data1[i], &parity);
+void pebble_ctx_set_tx_buffer(PebbleSerialContext *ctx, uint8_t *buffer, size_t length) {
+  // a buffer with no room in it can't be used, so fall back to writing a byte at a time
+  ctx->tx_buffer.buffer = length ? buffer : NULL;
+  ctx->tx_buffer.max_length = length;
+  ctx->tx_buffer.length = 0;
+}
+
+void pebble_ctx_set_tx_async(PebbleSerialContext *ctx, bool enabled) {
+  ctx->tx_buffer.is_async = enabled;
+}
+
+void pebble_ctx_tx_complete(PebbleSerialContext *ctx) {
+  ctx->tx_buffer.is_busy = false;
+}
+
+bool pebble_ctx_is_tx_busy(PebbleSerialContext *ctx) {
+  return ctx->tx_buffer.is_busy;
+}
+
+static void prv_flush_tx_buffer(PebbleSerialContext *ctx) {
+  if (ctx->tx_buffer.length) {
+    prv_send_cmd(ctx, SmartstrapCmdWriteBuffer, ctx->tx_buffer.length);
+    ctx->tx_buffer.length = 0;
   }
-  for (i = 0; i < length2; ++i) {
-    prv_send_byte(data2[i], &parity);
+}
+
+static inline void prv_write_raw_byte(PebbleSerialContext *ctx, uint8_t data) {
+  if (!ctx->tx_buffer.buffer) {
+    prv_send_cmd(ctx, SmartstrapCmdWriteByte, data);
+    return;
   }
+  if (ctx->tx_buffer.length == ctx->tx_buffer.max_length) {
+    // the TX buffer is full, so send what we have so far and start over
+    prv_flush_tx_buffer(ctx);
+  }
+  ctx->tx_buffer.buffer[ctx->tx_buffer.length++] = data;
+}
+
+static void prv_send_flag(PebbleSerialContext *ctx) {
+  prv_write_raw_byte(ctx, ENCODING_FLAG);
+}
+
+static void prv_encode_data(PebbleSerialContext *ctx, const uint8_t *data, size_t length) {
+  while (length) {
+    if (ctx->tx_buffer.buffer) {
+      // copy the run of bytes which don't need escaping straight into the TX buffer
+      size_t run = encoding_find_special(data, length);
+      while (run) {
+        if (ctx->tx_buffer.length == ctx->tx_buffer.max_length) {
+          prv_flush_tx_buffer(ctx);
+        }
+        size_t space = ctx->tx_buffer.max_length - ctx->tx_buffer.length;
+        size_t copy_length = (run < space) ? run : space;
+        memcpy(&ctx->tx_buffer.buffer[ctx->tx_buffer.length], data, copy_length);
+        ctx->tx_buffer.length += copy_length;
+        data += copy_length;
+        length -= copy_length;
+        run -= copy_length;
+      }
+      if (!length) {
+        break;
+      }
+    }
+    uint8_t byte = *data++;
+    length--;
+    if (encoding_encode(&byte)) {
+      prv_write_raw_byte(ctx, ENCODING_ESCAPE);
+    }
+    prv_write_raw_byte(ctx, byte);
+  }
+}
+
+static void prv_send_data(PebbleSerialContext *ctx, const uint8_t *data, size_t length,
+                          uint8_t *parity) {
+  crc8_calculate_buffer(data, length, parity);
+  prv_encode_data(ctx, data, length);
+}
+
+static void prv_write_begin(PebbleSerialContext *ctx, SmartstrapProfile profile, bool is_notify,
+                            uint8_t *parity) {
+  *parity = 0;
 
+  // enable tx
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, true);
+
+  // send flag
+  prv_send_flag(ctx);
+
+  // send the header - header flags are currently just hard-coded and the profile is well within a
+  // single byte
+  const uint8_t header[FRAME_PAYLOAD_OFFSET] = {
+    PROTOCOL_VERSION,
+    is_notify ? 0x04 : 0, 0, 0, 0,
+    profile, 0
+  };
+  prv_send_data(ctx, header, sizeof(header), parity);
+}
+
+static void prv_write_end(PebbleSerialContext *ctx, uint8_t parity) {
   // send parity
-  prv_send_byte(parity, &parity);
+  prv_encode_data(ctx, &parity, 1);
 
   // send flag
-  prv_send_flag();
+  prv_send_flag(ctx);
+
+  if (ctx->tx_buffer.buffer && ctx->tx_buffer.is_async) {
+    // Hand the rest of the frame to the transport, which will disable tx once it's been sent. This
+    // is marked as busy first since the transport may finish (from an ISR) before it returns.
+    const size_t length = ctx->tx_buffer.length;
+    ctx->tx_buffer.length = 0;
+    ctx->tx_buffer.is_busy = true;
+    ctx->callback(ctx->callback_context, SmartstrapCmdWriteBufferAsync, length);
+    return;
+  }
+  prv_flush_tx_buffer(ctx);
 
   // flush and disable tx
-  s_callback(SmartstrapCmdSetTxEnabled, false);
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, false);
+}
+
+static void prv_write_internal(PebbleSerialContext *ctx, SmartstrapProfile profile,
+                               const uint8_t *data1, size_t length1, const uint8_t *data2,
+                               size_t length2, bool is_notify) {
+  uint8_t parity;
+  prv_write_begin(ctx, profile, is_notify, &parity);
+  prv_send_data(ctx, data1, length1, &parity);
+  prv_send_data(ctx, data2, length2, &parity);
+  prv_write_end(ctx, parity);
+}
+
+static bool prv_response_begin(PebbleSerialContext *ctx, bool success, uint16_t length,
+                               uint8_t *parity) {
+  if (!ctx->pending_response.can_respond || ctx->pending_response.in_progress) {
+    return false;
+  }
+  if (ctx->pending_response.service_id == 0) {
+    if (ctx->pending_response.attribute_id != 0) {
+      return false;
+    }
+    prv_write_begin(ctx, SmartstrapProfileRawData, false, parity);
+  } else if (ctx->pending_response.service_id < 0x00FF) {
+    return false;
+  } else {
+    GenericServicePayload frame = (GenericServicePayload ) {
+      .version = GENERIC_SERVICE_VERSION,
+      .service_id = ctx->pending_response.service_id,
+      .attribute_id = ctx->pending_response.attribute_id,
+      .type = ctx->last_generic_service_type,
+      .error = success ? 0 : 1,
+      .length = length
+    };
+    prv_write_begin(ctx, SmartstrapProfileGenericService, false, parity);
+    prv_send_data(ctx, (uint8_t *)&frame, sizeof(frame), parity);
+  }
+  return true;
+}
+
+static void prv_response_end(PebbleSerialContext *ctx, uint8_t parity) {
+  prv_write_end(ctx, parity);
+  ctx->pending_response.can_respond = false;
+  ctx->pending_response.is_awaited = false;
 }
 
-static bool prv_supports_raw_data_profile(void) {
+static const PebbleAttribute *prv_find_attribute(PebbleSerialContext *ctx, uint16_t service_id,
+                                                 uint16_t attribute_id) {
+  // the attributes are sorted by service and then attribute, so do a binary search
+  const uint32_t key = prv_attribute_key(service_id, attribute_id);
+  uint8_t low = 0;
+  uint8_t high = ctx->num_attributes;
+  while (low < high) {
+    const uint8_t mid = low + (high - low) / 2;
+    const PebbleAttribute *attribute = &ctx->attributes[mid];
+    const uint32_t mid_key = prv_attribute_key(attribute->service_id, attribute->attribute_id);
+    if (mid_key == key) {
+      return attribute;
+    } else if (mid_key < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NULL;
+}
+
+static bool prv_supports_raw_data_profile(PebbleSerialContext *ctx) {
+  if (ctx->num_attributes) {
+    // the raw data attribute sorts first if there is one
+    return ctx->attributes[0].service_id == 0x0000;
+  }
   uint8_t i;
-  for (i = 0; i < s_num_supported_services; i++) {
-    if (s_supported_services[i] == 0x0000) {
+  for (i = 0; i < ctx->num_supported_services; i++) {
+    if (ctx->supported_services[i] == 0x0000) {
       return true;
     }
   }
   return false;
 }
 
-static bool prv_supports_generic_profile(void) {
+static bool prv_supports_generic_profile(PebbleSerialContext *ctx) {
+  if (ctx->num_attributes) {
+    return ctx->attributes[ctx->num_attributes - 1].service_id > 0x0000;
+  }
   uint8_t i;
-  for (i = 0; i < s_num_supported_services; i++) {
-    if (s_supported_services[i] > 0x0000) {
+  for (i = 0; i < ctx->num_supported_services; i++) {
+    if (ctx->supported_services[i] > 0x0000) {
       return true;
     }
   }
   return false;
 }
 
-static void prv_handle_link_control(uint8_t *buffer) {
+static void prv_handle_link_control(PebbleSerialContext *ctx, uint8_t *buffer) {
   // we will re-use the buffer for the response
   LinkControlType type = buffer[1];
   if (type == LinkControlTypeStatus) {
-    if (s_current_baud != s_target_baud) {
+    if (ctx->current_baud != ctx->target_baud) {
       buffer[2] = LinkControlStatusBaudRate;
     } else {
       buffer[2] = LinkControlStatusOk;
-      s_connected = true;
+      ctx->connected = true;
     }
-    prv_write_internal(SmartstrapProfileLinkControl, buffer, 3, NULL, 0, false);
+    prv_write_internal(ctx, SmartstrapProfileLinkControl, buffer, 3, NULL, 0, false);
   } else if (type == LinkControlTypeProfiles) {
     uint16_t profiles[2];
     uint8_t num_profiles = 0;
-    if (prv_supports_raw_data_profile()) {
+    if (prv_supports_raw_data_profile(ctx)) {
       profiles[num_profiles++] = SmartstrapProfileRawData;
     }
-    if (prv_supports_generic_profile()) {
+    if (prv_supports_generic_profile(ctx)) {
       profiles[num_profiles++] = SmartstrapProfileGenericService;
     }
-    prv_write_internal(SmartstrapProfileLinkControl, buffer, 2, (uint8_t *)profiles,
+    prv_write_internal(ctx, SmartstrapProfileLinkControl, buffer, 2, (uint8_t *)profiles,
                        num_profiles * sizeof(uint16_t), false);
   } else if (type == LinkControlTypeBaud) {
-    buffer[2] = s_target_baud;
-    prv_write_internal(SmartstrapProfileLinkControl, buffer, 3, NULL, 0, false);
-    prv_set_baud(s_target_baud);
+    buffer[2] = ctx->target_baud;
+    prv_write_internal(ctx, SmartstrapProfileLinkControl, buffer, 3, NULL, 0, false);
+    prv_set_baud(ctx, ctx->target_baud);
+  }
+}
+
+static void prv_write_attribute_services(PebbleSerialContext *ctx) {
+  // the attributes are sorted by service, so each service is listed once by skipping the
+  // attributes which have the same service as the one before
+  uint16_t num_services = 0;
+  uint8_t i;
+  for (i = 0; i < ctx->num_attributes; i++) {
+    if ((i == 0) || (ctx->attributes[i].service_id != ctx->attributes[i - 1].service_id)) {
+      num_services++;
+    }
+  }
+  uint8_t parity;
+  if (!prv_response_begin(ctx, true, num_services * sizeof(uint16_t), &parity)) {
+    return;
+  }
+  for (i = 0; i < ctx->num_attributes; i++) {
+    if ((i == 0) || (ctx->attributes[i].service_id != ctx->attributes[i - 1].service_id)) {
+      prv_send_data(ctx, (const uint8_t *)&ctx->attributes[i].service_id, sizeof(uint16_t),
+                    &parity);
+    }
+  }
+  prv_response_end(ctx, parity);
+}
+
+static const uint8_t *prv_read_attribute_value(const PebbleAttribute *attribute, uint8_t *scratch,
+                                               size_t scratch_length) {
+  if (!attribute->sequence) {
+    return attribute->value;
+  }
+  // The value may be updated (i.e. from an ISR) while we're reading it, so take a copy into the
+  // scratch buffer and make sure the sequence didn't change while we did so.
+  if (attribute->max_length > scratch_length) {
+    return NULL;
+  }
+  uint8_t attempt;
+  for (attempt = 0; attempt < VALUE_READ_ATTEMPTS; attempt++) {
+    const uint8_t sequence = *attribute->sequence;
+    PEBBLE_MEMORY_BARRIER();
+    memcpy(scratch, attribute->value, attribute->max_length);
+    PEBBLE_MEMORY_BARRIER();
+    if (!(sequence & 1) && (sequence == *attribute->sequence)) {
+      return scratch;
+    }
+  }
+  // the value was being updated every time we tried to read it
+  return NULL;
+}
+
+static void prv_write_attribute_value(PebbleSerialContext *ctx, const PebbleAttribute *attribute) {
+  const uint8_t *value = prv_read_attribute_value(attribute, ctx->frame.payload,
+                                                  ctx->frame.max_payload_length);
+  if (!value) {
+    pebble_ctx_write(ctx, false, NULL, 0);
+    return;
+  }
+  pebble_ctx_write(ctx, true, value, attribute->max_length);
+}
+
+static void prv_write_attribute_delta(PebbleSerialContext *ctx, const PebbleAttribute *attribute,
+                                      uint8_t watch_sequence) {
+  // this has to be read before the payload buffer is reused for the value
+  const uint8_t *value = prv_read_attribute_value(attribute, ctx->frame.payload,
+                                                  ctx->frame.max_payload_length);
+  if (!value) {
+    pebble_ctx_write(ctx, false, NULL, 0);
+    return;
+  }
+  PebbleDeltaState *delta = attribute->delta;
+  const size_t length = attribute->max_length;
+  uint8_t format = DELTA_FORMAT_FULL;
+  size_t delta_length = length;
+  if ((watch_sequence != 0) && (watch_sequence == delta->sequence) &&
+      (length <= DELTA_MAX_VALUE_LENGTH)) {
+    // the watch has the last value we sent, so see if sending just the changes is any shorter
+    size_t runs_length = 0;
+    size_t offset = 0;
+    size_t run_length;
+    while ((offset = delta_next_run(value, delta->last_value, length, offset, &run_length)) <
+           length) {
+      runs_length += 2 + run_length;
+      offset += run_length;
+    }
+    if (runs_length < length) {
+      format = DELTA_FORMAT_RUNS;
+      delta_length = runs_length;
+    }
+  }
+  uint8_t sequence = delta->sequence;
+  if ((format == DELTA_FORMAT_FULL) || (delta_length > 0)) {
+    // this is a new value as far as the watch is concerned (0 is reserved for no value)
+    sequence = (sequence == UINT8_MAX) ? 1 : (sequence + 1);
+  }
+
+  const uint8_t header[2] = { sequence, format };
+  if (sizeof(header) + delta_length > UINT16_MAX) {
+    pebble_ctx_write(ctx, false, NULL, 0);
+    return;
+  }
+  if (!pebble_ctx_write_begin(ctx, true, sizeof(header) + delta_length)) {
+    return;
+  }
+  pebble_ctx_write_chunk(ctx, header, sizeof(header));
+  if (format == DELTA_FORMAT_FULL) {
+    pebble_ctx_write_chunk(ctx, value, length);
+  } else {
+    size_t offset = 0;
+    size_t run_length;
+    while ((offset = delta_next_run(value, delta->last_value, length, offset, &run_length)) <
+           length) {
+      const uint8_t run_header[2] = { offset, run_length };
+      pebble_ctx_write_chunk(ctx, run_header, sizeof(run_header));
+      pebble_ctx_write_chunk(ctx, &value[offset], run_length);
+      offset += run_length;
+    }
+  }
+  if (!pebble_ctx_write_end(ctx)) {
+    // the watch didn't get this value, so it still has the one we sent last
+    return;
+  }
+  delta->sequence = sequence;
+  memcpy(delta->last_value, value, length);
+}
+
+static const PebbleAttribute *prv_batch_item(PebbleSerialContext *ctx, const uint8_t *request,
+                                             size_t index) {
+  uint16_t ids[2];
+  memcpy(ids, &request[index * sizeof(ids)], sizeof(ids));
+  return prv_find_attribute(ctx, ids[0], ids[1]);
+}
+
+static PebbleBatchStatus prv_batch_item_status(const PebbleAttribute *attribute,
+                                               size_t scratch_length) {
+  if (!attribute || !attribute->value ||
+      !(attribute->request_types & SmartstrapRequestMaskRead) ||
+      (attribute->max_length > UINT8_MAX) ||
+      (attribute->sequence && (attribute->max_length > scratch_length))) {
+    return PebbleBatchStatusNotSupported;
+  }
+  return PebbleBatchStatusOk;
+}
+
+static void prv_write_batch_read(PebbleSerialContext *ctx, size_t length) {
+  // The request stays in the payload buffer while the response is sent, so values which have to be
+  // copied before they're sent go after it.
+  const uint8_t *request = ctx->frame.payload;
+  const size_t num_items = length / (2 * sizeof(uint16_t));
+  uint8_t *scratch = &ctx->frame.payload[length];
+  const size_t scratch_length = ctx->frame.max_payload_length - length;
+  if (length % (2 * sizeof(uint16_t))) {
+    pebble_ctx_write(ctx, false, NULL, 0);
+    return;
+  }
+
+  // the response length goes in the header, so work it out first
+  size_t response_length = 0;
+  size_t i;
+  for (i = 0; i < num_items; i++) {
+    const PebbleAttribute *attribute = prv_batch_item(ctx, request, i);
+    response_length += 2;
+    if (prv_batch_item_status(attribute, scratch_length) == PebbleBatchStatusOk) {
+      response_length += attribute->max_length;
+    }
+  }
+  if ((response_length > UINT16_MAX) || !pebble_ctx_write_begin(ctx, true, response_length)) {
+    pebble_ctx_write(ctx, false, NULL, 0);
+    return;
+  }
+
+  for (i = 0; i < num_items; i++) {
+    const PebbleAttribute *attribute = prv_batch_item(ctx, request, i);
+    uint8_t item_header[2] = { prv_batch_item_status(attribute, scratch_length), 0 };
+    const uint8_t *value = NULL;
+    if (item_header[0] == PebbleBatchStatusOk) {
+      item_header[1] = attribute->max_length;
+      value = prv_read_attribute_value(attribute, scratch, scratch_length);
+      if (!value) {
+        item_header[0] = PebbleBatchStatusBusy;
+      }
+    }
+    pebble_ctx_write_chunk(ctx, item_header, sizeof(item_header));
+    if (value) {
+      pebble_ctx_write_chunk(ctx, value, item_header[1]);
+    } else {
+      // the length has already been sent, so fill in the value with zeros
+      const uint8_t zero = 0;
+      uint8_t j;
+      for (j = 0; j < item_header[1]; j++) {
+        pebble_ctx_write_chunk(ctx, &zero, 1);
+      }
+    }
+  }
+  pebble_ctx_write_end(ctx);
+}
+
+static bool prv_attribute_allows(const PebbleAttribute *attribute, SmartstrapRequestType type,
+                                 size_t length) {
+  return attribute && (attribute->request_types & (1 << type)) &&
+         (length <= attribute->max_length);
+}
+
+static bool prv_dispatch_attribute(PebbleSerialContext *ctx, uint16_t service_id,
+                                   uint16_t attribute_id, SmartstrapRequestType type,
+                                   size_t length) {
+  const PebbleAttribute *attribute = prv_find_attribute(ctx, service_id, attribute_id);
+  if (!prv_attribute_allows(attribute, type, length)) {
+    // reject the request (raw data frames have no way to report an error so are just dropped)
+    if (service_id != 0x0000) {
+      pebble_ctx_write(ctx, false, NULL, 0);
+    }
+    return true;
+  } else if ((service_id == PEBBLE_BATCH_SERVICE_ID) &&
+             (attribute_id == PEBBLE_BATCH_READ_ATTRIBUTE_ID)) {
+    prv_write_batch_read(ctx, length);
+    return true;
+  } else if (attribute->value && (type == SmartstrapRequestTypeRead)) {
+    // we can answer this read ourselves
+    prv_write_attribute_value(ctx, attribute);
+    return true;
+  } else if (attribute->value && attribute->delta && (type == SmartstrapRequestTypeWriteRead) &&
+             (length == 1)) {
+    // the request is the sequence number of the value the watch already has
+    prv_write_attribute_delta(ctx, attribute, ctx->frame.payload[0]);
+    return true;
+  } else if (!attribute->handler) {
+    // pass up to the user to handle
+    return false;
+  }
+  attribute->handler(ctx, attribute, type, ctx->frame.payload, length);
+  return true;
+}
+
+static void prv_pop_notification(PebbleSerialContext *ctx) {
+  ctx->notifications.count--;
+  memmove(&ctx->notifications.pending[0], &ctx->notifications.pending[1],
+          ctx->notifications.count * sizeof(ctx->notifications.pending[0]));
+  ctx->notifications.in_flight = false;
+}
+
+static void prv_send_notification(PebbleSerialContext *ctx) {
+  const uint16_t service_id = ctx->notifications.pending[0].service_id;
+  SmartstrapProfile profile;
+  if (service_id == 0) {
+    profile = SmartstrapProfileRawData;
+  } else {
+    profile = SmartstrapProfileGenericService;
+  }
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, true);
+  prv_send_cmd(ctx, SmartstrapCmdWriteBreak, 0);
+  prv_send_cmd(ctx, SmartstrapCmdWriteBreak, 0);
+  prv_send_cmd(ctx, SmartstrapCmdWriteBreak, 0);
+  prv_send_cmd(ctx, SmartstrapCmdSetTxEnabled, false);
+  prv_write_internal(ctx, profile, NULL, 0, NULL, 0, true);
+  ctx->notifications.last_time = ctx->current_time;
+  if (service_id == 0) {
+    // the watch doesn't read the notification info for the raw data profile
+    prv_pop_notification(ctx);
+  } else {
+    ctx->notifications.in_flight = true;
+  }
+}
+
+static bool prv_is_response_awaited(PebbleSerialContext *ctx) {
+  // the watch stops waiting for a response after its timeout, which is never longer than this
+  return ctx->pending_response.can_respond && ctx->pending_response.is_awaited &&
+         (ctx->current_time - ctx->last_message_time < NOTIFICATION_TIMEOUT_MS);
+}
+
+static void prv_check_notifications(PebbleSerialContext *ctx, uint32_t time) {
+  ctx->current_time = time;
+  const uint32_t elapsed = time - ctx->notifications.last_time;
+  if (ctx->notifications.in_flight) {
+    if (elapsed > NOTIFICATION_TIMEOUT_MS) {
+      // the watch never read the notification info, so give up on this one
+      prv_pop_notification(ctx);
+    } else {
+      return;
+    }
+  }
+  if ((ctx->notifications.count == 0) || (ctx->frame.length > 0) ||
+      ctx->pending_response.in_progress || prv_is_response_awaited(ctx) ||
+      (elapsed < ctx->notifications.min_interval)) {
+    // nothing to send, we're in the middle of receiving or sending a frame, the watch is waiting
+    // for a response to its last request, or it's too soon
+    return;
   }
+  prv_send_notification(ctx);
 }
 
-static bool prv_handle_generic_service(GenericServicePayload *data) {
+static bool prv_handle_generic_service(PebbleSerialContext *ctx, GenericServicePayload *data) {
   if (data->error != 0) {
     return true;
   }
 
   uint16_t service_id = data->service_id;
   uint16_t attribute_id = data->attribute_id;
-  s_last_generic_service_type = data->type;
+  ctx->last_generic_service_type = data->type;
   uint16_t length = data->length;
-  if ((service_id == 0x0101) && (attribute_id == 0x0002)) {
+  if ((service_id == MANAGEMENT_SERVICE_ID) &&
+      (attribute_id == MANAGEMENT_NOTIFICATION_INFO_ATTRIBUTE)) {
     // notification info attribute
-    if (s_notify_service) {
-      uint16_t info[2] = {s_notify_service, s_notify_attribute};
+    if (ctx->notifications.in_flight) {
+      uint16_t info[2] = {
+        ctx->notifications.pending[0].service_id,
+        ctx->notifications.pending[0].attribute_id
+      };
       length = sizeof(info);
-      s_pending_response.can_respond = true;
-      s_pending_response.service_id = service_id;
-      s_pending_response.attribute_id = attribute_id;
-      pebble_write(true, (uint8_t *)&info, length);
+      ctx->pending_response.can_respond = true;
+      ctx->pending_response.is_awaited = true;
+      ctx->pending_response.service_id = service_id;
+      ctx->pending_response.attribute_id = attribute_id;
+      pebble_ctx_write(ctx, true, (uint8_t *)&info, length);
+      // this notification has been delivered
+      prv_pop_notification(ctx);
     }
     return true;
-  } else if ((service_id == 0x0101) && (attribute_id == 0x0001)) {
+  } else if ((service_id == MANAGEMENT_SERVICE_ID) &&
+             (attribute_id == MANAGEMENT_SERVICE_DISCOVERY_ATTRIBUTE)) {
     // this is a service discovery frame
-    s_pending_response.can_respond = true;
-    s_pending_response.service_id = service_id;
-    s_pending_response.attribute_id = attribute_id;
-    pebble_write(true, (uint8_t *)s_supported_services,
-                 s_num_supported_services * sizeof(uint16_t));
+    ctx->pending_response.can_respond = true;
+    ctx->pending_response.is_awaited = true;
+    ctx->pending_response.service_id = service_id;
+    ctx->pending_response.attribute_id = attribute_id;
+    if (ctx->num_attributes) {
+      prv_write_attribute_services(ctx);
+    } else {
+      pebble_ctx_write(ctx, true, (uint8_t *)ctx->supported_services,
+                       ctx->num_supported_services * sizeof(uint16_t));
+    }
     return true;
   }
   return false;
 }
 
-static void prv_store_byte(const uint8_t data) {
+static inline size_t prv_service_header_length(PebbleSerialContext *ctx) {
+  if (ctx->frame.header.profile == SmartstrapProfileGenericService) {
+    return sizeof(GenericServicePayload);
+  }
+  return 0;
+}
+
+static inline bool prv_can_stream(PebbleSerialContext *ctx) {
+  return ctx->stream_handler && (ctx->frame.header.profile != SmartstrapProfileLinkControl);
+}
+
+static void prv_stream_event(PebbleSerialContext *ctx, PebbleStreamEvent event,
+                             const uint8_t *data, size_t length) {
+  uint16_t service_id = 0;
+  uint16_t attribute_id = 0;
+  if (ctx->frame.header.profile == SmartstrapProfileGenericService) {
+    // the service header always comes before any of the data
+    GenericServicePayload header;
+    memcpy(&header, ctx->frame.service_header, sizeof(header));
+    service_id = header.service_id;
+    attribute_id = header.attribute_id;
+  }
+  ctx->stream_handler(ctx, event, service_id, attribute_id, data, length);
+}
+
+static bool prv_stream_allowed(PebbleSerialContext *ctx, size_t length) {
+  // this is checked each time the payload buffer fills up, so the service header is all there
+  if (!ctx->num_attributes) {
+    return true;
+  }
+  uint16_t service_id = 0;
+  uint16_t attribute_id = 0;
+  SmartstrapRequestType type;
+  if (ctx->frame.header.profile == SmartstrapProfileGenericService) {
+    GenericServicePayload header;
+    memcpy(&header, ctx->frame.service_header, sizeof(header));
+    service_id = header.service_id;
+    attribute_id = header.attribute_id;
+    type = header.type;
+    length = header.length;
+  } else if (FLAGS_GET(ctx->frame.header.flags, FLAGS_IS_READ_MASK, FLAGS_IS_READ_OFFSET)) {
+    // a raw data frame's length isn't known until it ends, so this is checked with what's arrived
+    // so far, every time more has arrived
+    type = SmartstrapRequestTypeWriteRead;
+  } else {
+    type = SmartstrapRequestTypeWrite;
+  }
+  return prv_attribute_allows(prv_find_attribute(ctx, service_id, attribute_id), type, length);
+}
+
+static void prv_abort_stream(PebbleSerialContext *ctx) {
+  if (ctx->frame.stream_offset && !ctx->frame.is_rejected) {
+    // the handler has been passed some of this frame, so it has to throw that away
+    prv_stream_event(ctx, PebbleStreamEventAbort, NULL, 0);
+  }
+}
+
+static void prv_check_stream(PebbleSerialContext *ctx, size_t length) {
+  if (!ctx->frame.is_rejected && !prv_stream_allowed(ctx, length)) {
+    // a raw data frame can go over the attribute's max length after some of it was passed on
+    prv_abort_stream(ctx);
+    ctx->frame.is_rejected = true;
+  }
+}
+
+static inline void prv_store_payload_byte(PebbleSerialContext *ctx, size_t index, uint8_t data) {
+  // The generic service header is stored separately from the rest of the payload so that the data
+  // which follows it lands at the start of the payload buffer.
+  const size_t header_length = prv_service_header_length(ctx);
+  if (index < header_length) {
+    ctx->frame.service_header[index] = data;
+    return;
+  }
+  size_t offset = index - header_length - ctx->frame.stream_offset;
+  if (offset == ctx->frame.max_payload_length) {
+    // This can only happen when streaming. The buffer is full, so pass it on and start filling it
+    // again from the beginning. A request which the attribute table doesn't allow is still received
+    // (so it can be rejected once it ends) but isn't passed on.
+    prv_check_stream(ctx, ctx->frame.stream_offset + offset);
+    if (!ctx->frame.is_rejected) {
+      prv_stream_event(ctx, PebbleStreamEventData, ctx->frame.payload, offset);
+    }
+    ctx->frame.stream_offset += offset;
+    offset = 0;
+  }
+  ctx->frame.payload[offset] = data;
+}
+
+static void prv_drop_frame(PebbleSerialContext *ctx, uint16_t *counter) {
+  if (!ctx->frame.should_drop) {
+    ctx->frame.should_drop = true;
+    (*counter)++;
+  }
+}
+
+static bool prv_header_validate(PebbleSerialContext *ctx) {
+  return (ctx->frame.header.version > 0) &&
+         (ctx->frame.header.version <= PROTOCOL_VERSION) &&
+         (FLAGS_GET(ctx->frame.header.flags, FLAGS_IS_MASTER_MASK, FLAGS_IS_MASTER_OFFSET) == 1) &&
+         (FLAGS_GET(ctx->frame.header.flags, FLAGS_RESERVED_MASK, FLAGS_RESERVED_OFFSET) == 0) &&
+         (ctx->frame.header.profile > SmartstrapProfileInvalid) &&
+         (ctx->frame.header.profile < NumSmartstrapProfiles);
+}
+
+static void prv_select_payload_buffer(PebbleSerialContext *ctx) {
+  if (ctx->frame.header.profile == SmartstrapProfileLinkControl) {
+    // Link control frames have their own buffer so that they are always handled, even while the
+    // application has all of the receive buffers.
+    ctx->frame.payload = ctx->control_payload;
+    ctx->frame.max_payload_length = sizeof(ctx->control_payload);
+  } else if (ctx->rx_buffers.current) {
+    ctx->frame.payload = ctx->rx_buffers.current;
+    ctx->frame.max_payload_length = ctx->rx_buffers.current_length;
+  } else {
+    prv_drop_frame(ctx, &ctx->drop_counters.no_buffer);
+  }
+}
+
+static void prv_store_byte(PebbleSerialContext *ctx, const uint8_t data) {
   // Find which field this byte belongs to based on the number of bytes we've received so far
-  if (s_frame.length >= FRAME_PAYLOAD_OFFSET) {
+  if (ctx->frame.length >= FRAME_PAYLOAD_OFFSET) {
     // This byte is part of either the payload or the checksum
-    const uint32_t payload_length = s_frame.length - FRAME_PAYLOAD_OFFSET;
-    if (payload_length > s_frame.max_payload_length) {
-      // The payload is longer than the payload buffer so drop this byte
-      s_frame.should_drop = true;
+    const uint32_t payload_length = ctx->frame.length - FRAME_PAYLOAD_OFFSET;
+    if ((payload_length > ctx->frame.max_payload_length + prv_service_header_length(ctx)) &&
+        !prv_can_stream(ctx)) {
+      // The payload is longer than the payload buffer (and can't be streamed) so drop the frame
+      prv_drop_frame(ctx, &ctx->drop_counters.overflow);
+      return;
     } else {
       // The checksum byte comes after the payload in the frame. This byte we are receiving could
       // be the checksum byte, or it could be part of the payload; we don't know at this point. So,
@@ -282,180 +871,528 @@ static void prv_store_byte(const uint8_t data) {
       // buffer if it's conservatively sized.
       if (payload_length > 0) {
         // put the previous byte into the payload buffer
-        s_frame.payload[payload_length - 1] = s_frame.footer_byte;
+        prv_store_payload_byte(ctx, payload_length - 1, ctx->frame.footer_byte);
       }
-      s_frame.footer_byte = data;
+      ctx->frame.footer_byte = data;
     }
-  } else if (s_frame.length >= FRAME_PROFILE_OFFSET) {
+  } else if (ctx->frame.length >= FRAME_PROFILE_OFFSET) {
     // This byte is part of the profile field
-    const uint32_t byte_offset = s_frame.length - FRAME_PROFILE_OFFSET;
-    s_frame.header.profile |= (data << (byte_offset * 8));
-  } else if (s_frame.length >= FRAME_FLAGS_OFFSET) {
+    const uint32_t byte_offset = ctx->frame.length - FRAME_PROFILE_OFFSET;
+    ctx->frame.header.profile |= (data << (byte_offset * 8));
+  } else if (ctx->frame.length >= FRAME_FLAGS_OFFSET) {
     // This byte is part of the flags field
-    const uint32_t byte_offset = s_frame.length - FRAME_FLAGS_OFFSET;
-    s_frame.header.flags |= (data << (byte_offset * 8));
+    const uint32_t byte_offset = ctx->frame.length - FRAME_FLAGS_OFFSET;
+    ctx->frame.header.flags |= (data << (byte_offset * 8));
   } else {
     // The version field should always be first (and a single byte)
-    s_frame.header.version = data;
+    ctx->frame.header.version = data;
   }
 
   // increment the length run the CRC calculation
-  s_frame.length++;
-  crc8_calculate_byte_streaming(data, &s_frame.checksum);
-}
-
-static void prv_frame_validate(void) {
-  if ((s_frame.should_drop == false) &&
-      (s_frame.header.version > 0) &&
-      (s_frame.header.version <= PROTOCOL_VERSION) &&
-      (FLAGS_GET(s_frame.header.flags, FLAGS_IS_MASTER_MASK, FLAGS_IS_MASTER_OFFSET) == 1) &&
-      (FLAGS_GET(s_frame.header.flags, FLAGS_RESERVED_MASK, FLAGS_RESERVED_OFFSET) == 0) &&
-      (s_frame.header.profile > SmartstrapProfileInvalid) &&
-      (s_frame.header.profile < NumSmartstrapProfiles) &&
-      (s_frame.length >= FRAME_MIN_LENGTH) &&
-      (s_frame.checksum == 0)) {
-    // this is a valid frame
-  } else {
-    // drop the frame
-    s_frame.should_drop = true;
+  ctx->frame.length++;
+  crc8_calculate_byte_streaming(data, &ctx->frame.checksum);
+
+  if (ctx->frame.length == FRAME_PAYLOAD_OFFSET) {
+    if (prv_header_validate(ctx)) {
+      prv_select_payload_buffer(ctx);
+    } else {
+      // We have the whole header and it's not valid, so there's no point storing the rest of the
+      // frame. This also catches our own frames if they are echoed back to us.
+      prv_drop_frame(ctx, &ctx->drop_counters.header);
+    }
   }
 }
 
-bool pebble_handle_byte(uint8_t data, uint16_t *service_id, uint16_t *attribute_id, size_t *length,
-                        SmartstrapRequestType *type, uint32_t time) {
-  if (!s_frame.read_ready) {
-    // we shouldn't be reading new data
+static bool prv_service_header_validate(PebbleSerialContext *ctx) {
+  const size_t header_length = prv_service_header_length(ctx);
+  if (!header_length) {
+    return true;
+  }
+  // the length in the header must match the amount of data we actually received
+  const size_t payload_length = ctx->frame.length - FRAME_MIN_LENGTH;
+  if (payload_length < header_length) {
     return false;
   }
+  GenericServicePayload header;
+  memcpy(&header, ctx->frame.service_header, sizeof(header));
+  return header.length == payload_length - header_length;
+}
 
+static void prv_frame_validate(PebbleSerialContext *ctx) {
+  // the header was already checked once it was received
+  if (ctx->frame.should_drop) {
+    // already dropped
+  } else if (ctx->frame.length == 0) {
+    // there's nothing between back-to-back flags, so there's nothing to count
+    ctx->frame.should_drop = true;
+  } else if (ctx->frame.length < FRAME_MIN_LENGTH) {
+    prv_drop_frame(ctx, &ctx->drop_counters.length);
+  } else if (ctx->frame.checksum != 0) {
+    prv_drop_frame(ctx, &ctx->drop_counters.checksum);
+  } else if (!prv_service_header_validate(ctx)) {
+    prv_drop_frame(ctx, &ctx->drop_counters.length);
+  }
+}
+
+static size_t prv_store_run(PebbleSerialContext *ctx, const uint8_t *data, size_t length) {
+  // The run has to start after the generic service header (if there is one) and is limited to the
+  // bytes which fit in the payload buffer (and the trailing footer byte). Bytes outside of that are
+  // left to prv_store_byte() to either store in the header or drop the frame.
+  const size_t header_length = prv_service_header_length(ctx);
+  const size_t payload_length = ctx->frame.length - FRAME_PAYLOAD_OFFSET;
+  if ((payload_length < header_length) ||
+      (payload_length - header_length - ctx->frame.stream_offset >
+       ctx->frame.max_payload_length)) {
+    return 0;
+  }
+  // where the footer byte goes in the payload buffer
+  const size_t data_length = payload_length - header_length - ctx->frame.stream_offset;
+  const size_t max_run = ctx->frame.max_payload_length - data_length + 1;
+
+  // Find the run of bytes at the start of the data which don't need any decoding
+  const size_t run = encoding_find_special(data, (length < max_run) ? length : max_run);
+  if (run == 0) {
+    return 0;
+  }
+
+  // This does the same thing as calling prv_store_byte() for each byte in the run. The previous
+  // footer byte and all but the last byte of the run go into the payload buffer, and the last byte
+  // of the run becomes the new footer byte.
+  if (payload_length > 0) {
+    prv_store_payload_byte(ctx, payload_length - 1, ctx->frame.footer_byte);
+  }
+  memcpy(&ctx->frame.payload[data_length], data, run - 1);
+  ctx->frame.footer_byte = data[run - 1];
+  ctx->frame.length += run;
+  crc8_calculate_buffer(data, run, &ctx->frame.checksum);
+  return run;
+}
+
+static bool prv_decode_byte(PebbleSerialContext *ctx, uint8_t data) {
   bool encoding_err, should_store = false;
-  bool is_complete = encoding_streaming_decode(&s_frame.encoding_ctx, &data, &should_store,
+  bool is_complete = encoding_streaming_decode(&ctx->frame.encoding_ctx, &data, &should_store,
                                                &encoding_err);
   if (encoding_err) {
-    s_frame.should_drop = true;
+    prv_drop_frame(ctx, &ctx->drop_counters.encoding);
   } else if (is_complete) {
-    prv_frame_validate();
+    prv_frame_validate(ctx);
   } else if (should_store) {
-    prv_store_byte(data);
+    prv_store_byte(ctx, data);
   }
 
-  if (s_frame.should_drop || is_complete) {
+  if (ctx->frame.should_drop || is_complete) {
     // prepare the encoding context for the next frame
-    encoding_streaming_decode_reset(&s_frame.encoding_ctx);
-  }
-
-  if (is_complete) {
-    bool give_to_user = false;
-    if (s_frame.should_drop) {
-      // reset the frame
-      pebble_prepare_for_read(s_frame.payload, s_frame.max_payload_length);
-    } else if (s_frame.header.profile == SmartstrapProfileLinkControl) {
-      s_last_message_time = time;
-      // handle this link control frame
-      prv_handle_link_control(s_frame.payload);
-      // prepare for the next frame
-      pebble_prepare_for_read(s_frame.payload, s_frame.max_payload_length);
-    } else if (s_frame.header.profile == SmartstrapProfileGenericService) {
-      GenericServicePayload header = *(GenericServicePayload *)s_frame.payload;
-      memmove(s_frame.payload, &s_frame.payload[sizeof(header)], header.length);
-      // handle this generic service frame
-      if (prv_handle_generic_service(&header)) {
-        s_last_message_time = time;
-        // we handled it, so prepare for the next frame
-        pebble_prepare_for_read(s_frame.payload, s_frame.max_payload_length);
-      } else {
-        // pass up to user to handle
-        give_to_user = true;
-        *service_id = header.service_id;
-        *attribute_id = header.attribute_id;
-        *length = header.length;
-        *type = header.type;
-      }
+    encoding_streaming_decode_reset(&ctx->frame.encoding_ctx);
+  }
+  return is_complete;
+}
+
+static void prv_end_stream(PebbleSerialContext *ctx, uint32_t time) {
+  // pass on whatever is left in the buffer before ending the stream
+  const size_t total_length = ctx->frame.length - FRAME_MIN_LENGTH - prv_service_header_length(ctx);
+  prv_check_stream(ctx, total_length);
+  if (!ctx->frame.is_rejected && (total_length > ctx->frame.stream_offset)) {
+    prv_stream_event(ctx, PebbleStreamEventData, ctx->frame.payload,
+                     total_length - ctx->frame.stream_offset);
+  }
+  ctx->last_message_time = time;
+  ctx->pending_response.service_id = 0;
+  ctx->pending_response.attribute_id = 0;
+  if (ctx->frame.header.profile == SmartstrapProfileGenericService) {
+    GenericServicePayload header;
+    memcpy(&header, ctx->frame.service_header, sizeof(header));
+    ctx->pending_response.service_id = header.service_id;
+    ctx->pending_response.attribute_id = header.attribute_id;
+    ctx->last_generic_service_type = header.type;
+  }
+  ctx->pending_response.can_respond = true;
+  // the watch only waits for a response to a raw data frame if it's a read
+  ctx->pending_response.is_awaited =
+      (ctx->frame.header.profile == SmartstrapProfileGenericService) ||
+      FLAGS_GET(ctx->frame.header.flags, FLAGS_IS_READ_MASK, FLAGS_IS_READ_OFFSET);
+  if (ctx->frame.is_rejected) {
+    // reject it the same way as prv_dispatch_attribute() (raw data frames have no way to report an
+    // error so are just dropped)
+    if (ctx->pending_response.service_id != 0x0000) {
+      pebble_ctx_write(ctx, false, NULL, 0);
+    }
+    return;
+  }
+  prv_stream_event(ctx, PebbleStreamEventEnd, NULL, total_length);
+}
+
+static bool prv_handle_frame(PebbleSerialContext *ctx, uint16_t *service_id,
+                             uint16_t *attribute_id, size_t *length, SmartstrapRequestType *type,
+                             uint32_t time) {
+  bool give_to_user = false;
+  if (ctx->frame.should_drop) {
+    prv_abort_stream(ctx);
+    // reset the frame
+    prv_reset_frame(ctx);
+  } else if (ctx->frame.stream_offset) {
+    prv_end_stream(ctx, time);
+    prv_reset_frame(ctx);
+  } else if (ctx->frame.header.profile == SmartstrapProfileLinkControl) {
+    ctx->last_message_time = time;
+    // handle this link control frame
+    prv_handle_link_control(ctx, ctx->frame.payload);
+    // prepare for the next frame
+    prv_reset_frame(ctx);
+  } else if (ctx->frame.header.profile == SmartstrapProfileGenericService) {
+    GenericServicePayload header;
+    memcpy(&header, ctx->frame.service_header, sizeof(header));
+    // handle this generic service frame
+    if (prv_handle_generic_service(ctx, &header)) {
+      ctx->last_message_time = time;
+      // we handled it, so prepare for the next frame
+      prv_reset_frame(ctx);
     } else {
+      // pass up to user to handle
       give_to_user = true;
-      *service_id = 0;
-      *attribute_id = 0;
-      *length = s_frame.length - FRAME_MIN_LENGTH;
-      if (FLAGS_GET(s_frame.header.flags, FLAGS_IS_READ_MASK, FLAGS_IS_READ_OFFSET)) {
-        if (*length) {
-          *type = SmartstrapRequestTypeWriteRead;
-        } else {
-          *type = SmartstrapRequestTypeRead;
-        }
+      *service_id = header.service_id;
+      *attribute_id = header.attribute_id;
+      *length = header.length;
+      *type = header.type;
+    }
+  } else {
+    give_to_user = true;
+    *service_id = 0;
+    *attribute_id = 0;
+    *length = ctx->frame.length - FRAME_MIN_LENGTH;
+    if (FLAGS_GET(ctx->frame.header.flags, FLAGS_IS_READ_MASK, FLAGS_IS_READ_OFFSET)) {
+      if (*length) {
+        *type = SmartstrapRequestTypeWriteRead;
       } else {
-        *type = SmartstrapRequestTypeWrite;
+        *type = SmartstrapRequestTypeRead;
       }
+    } else {
+      *type = SmartstrapRequestTypeWrite;
     }
-    if (give_to_user) {
-      s_last_message_time = time;
-      s_frame.read_ready = false;
-      s_pending_response.service_id = *service_id;
-      s_pending_response.attribute_id = *attribute_id;
-      s_pending_response.can_respond = true;
-      return true;
+  }
+  if (give_to_user) {
+    ctx->last_message_time = time;
+    ctx->pending_response.service_id = *service_id;
+    ctx->pending_response.attribute_id = *attribute_id;
+    ctx->pending_response.can_respond = true;
+    ctx->pending_response.is_awaited = (*service_id != 0) || (*type != SmartstrapRequestTypeWrite);
+    if (ctx->num_attributes &&
+        prv_dispatch_attribute(ctx, *service_id, *attribute_id, *type, *length)) {
+      // we handled it, so prepare for the next frame
+      prv_reset_frame(ctx);
+      return false;
     }
+    prv_next_rx_buffer(ctx);
+    prv_reset_frame(ctx);
   }
+  return give_to_user;
+}
 
-  if (time < s_last_message_time) {
+static void prv_check_timeout(PebbleSerialContext *ctx, uint32_t time) {
+  if (time < ctx->last_message_time) {
     // wrapped around
-    s_last_message_time = time;
-  } else if (time - s_last_message_time > 10000) {
+    ctx->last_message_time = time;
+  } else if (time - ctx->last_message_time > 10000) {
     // haven't received a valid frame in over 10 seconds so reset the baudrate
-    prv_set_baud(PebbleBaud9600);
-    s_connected = false;
+    prv_set_baud(ctx, PebbleBaud9600);
+    ctx->connected = false;
   }
+}
 
+bool pebble_ctx_handle_bytes(PebbleSerialContext *ctx, const uint8_t *data, size_t length,
+                             size_t *consumed, uint16_t *service_id, uint16_t *attribute_id,
+                             size_t *payload_length, SmartstrapRequestType *type, uint32_t time) {
+  size_t i = 0;
+  while (i < length) {
+    if (ctx->frame.should_drop) {
+      // this frame is being dropped, so skip straight to the flag which ends it
+      const uint8_t *flag = memchr(&data[i], ENCODING_FLAG, length - i);
+      if (!flag) {
+        break;
+      }
+      i = flag - data;
+    } else if (!ctx->frame.encoding_ctx.escape && (ctx->frame.length >= FRAME_PAYLOAD_OFFSET)) {
+      // we're in the middle of the payload, so copy as many bytes as possible in one go
+      const size_t run = prv_store_run(ctx, &data[i], length - i);
+      if (run) {
+        i += run;
+        continue;
+      }
+    }
+
+    if (prv_decode_byte(ctx, data[i++]) &&
+        prv_handle_frame(ctx, service_id, attribute_id, payload_length, type, time)) {
+      // we have a full frame for the user, so leave the rest of the data for the next call
+      *consumed = i;
+      return true;
+    }
+  }
+
+  *consumed = length;
+  prv_check_timeout(ctx, time);
+  prv_check_notifications(ctx, time);
   return false;
 }
 
-bool pebble_write(bool success, const uint8_t *buffer, uint16_t length) {
-  if (!s_pending_response.can_respond) {
+bool pebble_ctx_handle_byte(PebbleSerialContext *ctx, uint8_t data, uint16_t *service_id,
+                            uint16_t *attribute_id, size_t *length, SmartstrapRequestType *type,
+                            uint32_t time) {
+  size_t consumed;
+  return pebble_ctx_handle_bytes(ctx, &data, 1, &consumed, service_id, attribute_id, length, type,
+                                 time);
+}
+
+bool pebble_ctx_decode_byte(PebbleSerialContext *ctx, uint8_t data) {
+  if (ctx->frame_ready) {
+    // the main loop hasn't handled the last frame yet, so we have nowhere to put this byte
+    ctx->rx_overrun = true;
+    return true;
+  }
+  if (ctx->frame.should_drop && (data != ENCODING_FLAG)) {
+    // skip to the flag which ends this frame
     return false;
   }
-  if (s_pending_response.service_id == 0) {
-    if (s_pending_response.attribute_id != 0) {
-      return false;
+  if (!prv_decode_byte(ctx, data)) {
+    return false;
+  }
+  if (ctx->frame.should_drop) {
+    prv_abort_stream(ctx);
+    prv_reset_frame(ctx);
+    return false;
+  }
+  ctx->frame_ready = true;
+  return true;
+}
+
+bool pebble_ctx_handle_ready_frame(PebbleSerialContext *ctx, uint16_t *service_id,
+                                   uint16_t *attribute_id, size_t *length,
+                                   SmartstrapRequestType *type, uint32_t time) {
+  bool give_to_user = false;
+  if (ctx->frame_ready) {
+    // the ISR leaves the frame alone until frame_ready is cleared
+    give_to_user = prv_handle_frame(ctx, service_id, attribute_id, length, type, time);
+    if (ctx->rx_overrun) {
+      // bytes were lost while the frame was waiting, so skip to the start of the next frame
+      ctx->rx_overrun = false;
+      prv_drop_frame(ctx, &ctx->drop_counters.no_buffer);
     }
-    prv_write_internal(SmartstrapProfileRawData, buffer, length, NULL, 0, false);
-  } else if (s_pending_response.service_id < 0x00FF) {
+    PEBBLE_MEMORY_BARRIER();
+    ctx->frame_ready = false;
+  }
+  if (!give_to_user) {
+    prv_check_timeout(ctx, time);
+    prv_check_notifications(ctx, time);
+  }
+  return give_to_user;
+}
+
+bool pebble_ctx_write(PebbleSerialContext *ctx, bool success, const uint8_t *buffer,
+                      uint16_t length) {
+  uint8_t parity;
+  if (!prv_response_begin(ctx, success, length, &parity)) {
     return false;
-  } else {
-    GenericServicePayload frame = (GenericServicePayload ) {
-      .version = GENERIC_SERVICE_VERSION,
-      .service_id = s_pending_response.service_id,
-      .attribute_id = s_pending_response.attribute_id,
-      .type = s_last_generic_service_type,
-      .error = success ? 0 : 1,
-      .length = length
-    };
-    prv_write_internal(SmartstrapProfileGenericService, (uint8_t *)&frame, sizeof(frame), buffer,
-                       length, false);
   }
-  s_pending_response.can_respond = false;
+  prv_send_data(ctx, buffer, length, &parity);
+  prv_response_end(ctx, parity);
   return true;
 }
 
-void pebble_notify(uint16_t service_id, uint16_t attribute_id) {
-  s_notify_service = service_id;
-  s_notify_attribute = attribute_id;
-  SmartstrapProfile profile;
-  if (service_id == 0) {
-    profile = SmartstrapProfileRawData;
+bool pebble_ctx_write_begin(PebbleSerialContext *ctx, bool success, uint16_t length) {
+  if (!prv_response_begin(ctx, success, length, &ctx->pending_response.parity)) {
+    return false;
+  }
+  ctx->pending_response.in_progress = true;
+  ctx->pending_response.remaining = length;
+  return true;
+}
+
+bool pebble_ctx_write_chunk(PebbleSerialContext *ctx, const uint8_t *data, uint16_t length) {
+  if (!ctx->pending_response.in_progress || (length > ctx->pending_response.remaining)) {
+    return false;
+  }
+  prv_send_data(ctx, data, length, &ctx->pending_response.parity);
+  ctx->pending_response.remaining -= length;
+  return true;
+}
+
+bool pebble_ctx_write_end(PebbleSerialContext *ctx) {
+  if (!ctx->pending_response.in_progress) {
+    return false;
+  }
+  // the length was already sent in the header, so the frame has to be finished with that many bytes
+  const bool is_complete = (ctx->pending_response.remaining == 0);
+  const uint8_t zero = 0;
+  while (ctx->pending_response.remaining) {
+    prv_send_data(ctx, &zero, 1, &ctx->pending_response.parity);
+    ctx->pending_response.remaining--;
+  }
+  ctx->pending_response.in_progress = false;
+  prv_response_end(ctx, ctx->pending_response.parity);
+  return is_complete;
+}
+
+static void prv_lz_write(void *context, const uint8_t *data, size_t length) {
+  pebble_ctx_write_chunk(context, data, length);
+}
+
+bool pebble_ctx_write_compressed(PebbleSerialContext *ctx, bool success, const uint8_t *buffer,
+                                 uint16_t length) {
+  // The length has to be sent before the data, so this compresses twice: once to find the length
+  // and again to send it. That costs CPU time rather than a buffer for the compressed data.
+  const size_t compressed_length = lz_compress(buffer, length, NULL, NULL);
+  const uint8_t format = (compressed_length < length) ? LZ_FORMAT_COMPRESSED : LZ_FORMAT_STORED;
+  const size_t data_length = (format == LZ_FORMAT_COMPRESSED) ? compressed_length : length;
+  if (data_length > UINT16_MAX - 1) {
+    // there's no room left for the format byte in the response's length
+    return false;
+  }
+  if (!pebble_ctx_write_begin(ctx, success, 1 + data_length)) {
+    return false;
+  }
+  pebble_ctx_write_chunk(ctx, &format, 1);
+  if (format == LZ_FORMAT_COMPRESSED) {
+    lz_compress(buffer, length, prv_lz_write, ctx);
   } else {
-    profile = SmartstrapProfileGenericService;
+    pebble_ctx_write_chunk(ctx, buffer, length);
   }
-  s_callback(SmartstrapCmdSetTxEnabled, true);
-  s_callback(SmartstrapCmdWriteBreak, 0);
-  s_callback(SmartstrapCmdWriteBreak, 0);
-  s_callback(SmartstrapCmdWriteBreak, 0);
-  s_callback(SmartstrapCmdSetTxEnabled, false);
-  prv_write_internal(profile, NULL, 0, NULL, 0, true);
+  return pebble_ctx_write_end(ctx);
 }
 
-bool pebble_is_connected(uint32_t time) {
-  if (time - s_last_message_time > 10000) {
-    prv_set_baud(PebbleBaud9600);
-    s_connected = false;
+bool pebble_ctx_notify(PebbleSerialContext *ctx, uint16_t service_id, uint16_t attribute_id,
+                       uint32_t time) {
+  uint8_t i;
+  for (i = 0; i < ctx->notifications.count; i++) {
+    if ((ctx->notifications.pending[i].service_id == service_id) &&
+        (ctx->notifications.pending[i].attribute_id == attribute_id) &&
+        ((i > 0) || !ctx->notifications.in_flight)) {
+      // there's already a notification for this attribute which hasn't been sent yet
+      return true;
+    }
   }
-  return s_connected;
+  if (ctx->notifications.count == PEBBLE_MAX_PENDING_NOTIFICATIONS) {
+    return false;
+  }
+  ctx->notifications.pending[ctx->notifications.count].service_id = service_id;
+  ctx->notifications.pending[ctx->notifications.count].attribute_id = attribute_id;
+  ctx->notifications.count++;
+  prv_check_notifications(ctx, time);
+  return true;
+}
+
+void pebble_ctx_set_notify_interval(PebbleSerialContext *ctx, uint16_t interval_ms) {
+  ctx->notifications.min_interval = interval_ms;
+}
+
+bool pebble_ctx_is_connected(PebbleSerialContext *ctx, uint32_t time) {
+  prv_check_notifications(ctx, time);
+  if (time - ctx->last_message_time > 10000) {
+    prv_set_baud(ctx, PebbleBaud9600);
+    ctx->connected = false;
+  }
+  return ctx->connected;
+}
+
+void pebble_ctx_get_drop_counters(PebbleSerialContext *ctx, PebbleDropCounters *counters) {
+  *counters = ctx->drop_counters;
+}
+
+
+// Default context
+////////////////////////////////////////////////////////////////////////////////
+
+static void prv_default_callback(void *context, SmartstrapCmd cmd, uint32_t arg) {
+  (void)context;
+  s_default_callback(cmd, arg);
+}
+
+void pebble_init(SmartstrapCallback callback, PebbleBaud baud, const uint16_t *services,
+                 uint8_t num_services) {
+  s_default_callback = callback;
+  pebble_ctx_init(&s_default_ctx, prv_default_callback, NULL, baud, services, num_services);
+}
+
+bool pebble_prepare_for_read(uint8_t *buffer, size_t length) {
+  return pebble_ctx_prepare_for_read(&s_default_ctx, buffer, length);
+}
+
+bool pebble_set_attributes(PebbleAttribute *attributes, uint8_t num_attributes) {
+  return pebble_ctx_set_attributes(&s_default_ctx, attributes, num_attributes);
+}
+
+void pebble_set_stream_handler(PebbleStreamHandler handler) {
+  pebble_ctx_set_stream_handler(&s_default_ctx, handler);
+}
+
+void pebble_set_tx_buffer(uint8_t *buffer, size_t length) {
+  pebble_ctx_set_tx_buffer(&s_default_ctx, buffer, length);
+}
+
+void pebble_set_tx_async(bool enabled) {
+  pebble_ctx_set_tx_async(&s_default_ctx, enabled);
+}
+
+void pebble_tx_complete(void) {
+  pebble_ctx_tx_complete(&s_default_ctx);
+}
+
+bool pebble_is_tx_busy(void) {
+  return pebble_ctx_is_tx_busy(&s_default_ctx);
+}
+
+bool pebble_handle_byte(uint8_t data, uint16_t *service_id, uint16_t *attribute_id, size_t *length,
+                        SmartstrapRequestType *type, uint32_t time) {
+  return pebble_ctx_handle_byte(&s_default_ctx, data, service_id, attribute_id, length, type,
+                                time);
+}
+
+bool pebble_handle_bytes(const uint8_t *data, size_t length, size_t *consumed,
+                         uint16_t *service_id, uint16_t *attribute_id, size_t *payload_length,
+                         SmartstrapRequestType *type, uint32_t time) {
+  return pebble_ctx_handle_bytes(&s_default_ctx, data, length, consumed, service_id, attribute_id,
+                                 payload_length, type, time);
+}
+
+bool pebble_decode_byte(uint8_t data) {
+  return pebble_ctx_decode_byte(&s_default_ctx, data);
+}
+
+bool pebble_handle_ready_frame(uint16_t *service_id, uint16_t *attribute_id, size_t *length,
+                               SmartstrapRequestType *type, uint32_t time_ms) {
+  return pebble_ctx_handle_ready_frame(&s_default_ctx, service_id, attribute_id, length, type,
+                                       time_ms);
+}
+
+bool pebble_write(bool success, const uint8_t *buffer, uint16_t length) {
+  return pebble_ctx_write(&s_default_ctx, success, buffer, length);
+}
+
+bool pebble_write_begin(bool success, uint16_t length) {
+  return pebble_ctx_write_begin(&s_default_ctx, success, length);
+}
+
+bool pebble_write_chunk(const uint8_t *data, uint16_t length) {
+  return pebble_ctx_write_chunk(&s_default_ctx, data, length);
+}
+
+bool pebble_write_end(void) {
+  return pebble_ctx_write_end(&s_default_ctx);
+}
+
+bool pebble_write_compressed(bool success, const uint8_t *buffer, uint16_t length) {
+  return pebble_ctx_write_compressed(&s_default_ctx, success, buffer, length);
+}
+
+bool pebble_notify(uint16_t service_id, uint16_t attribute_id, uint32_t time) {
+  return pebble_ctx_notify(&s_default_ctx, service_id, attribute_id, time);
+}
+
+void pebble_set_notify_interval(uint16_t interval_ms) {
+  pebble_ctx_set_notify_interval(&s_default_ctx, interval_ms);
+}
+
+bool pebble_is_connected(uint32_t time) {
+  return pebble_ctx_is_connected(&s_default_ctx, time);
+}
+
+void pebble_get_drop_counters(PebbleDropCounters *counters) {
+  pebble_ctx_get_drop_counters(&s_default_ctx, counters);
 }
@@ -5,9 +5,24 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "encoding.h"
+
 #define PEBBLE_MIN_PAYLOAD      (20 + PEBBLE_PAYLOAD_OVERHEAD)
 #define PEBBLE_PAYLOAD_OVERHEAD 9
 
+// The number of receive buffers which can be queued up behind the one currently being filled.
+#ifndef PEBBLE_MAX_RX_BUFFERS
+#define PEBBLE_MAX_RX_BUFFERS 2
+#endif
+
+// The number of different attributes which can have a notification waiting to be sent.
+#ifndef PEBBLE_MAX_PENDING_NOTIFICATIONS
+#define PEBBLE_MAX_PENDING_NOTIFICATIONS 4
+#endif
+
+// The size of the buffer which link control frames are received into.
+#define PEBBLE_CONTROL_PAYLOAD_LENGTH 8
+
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define GET_PAYLOAD_BUFFER_SIZE(max_data_length) \
   MAX(max_data_length + PEBBLE_PAYLOAD_OVERHEAD, PEBBLE_MIN_PAYLOAD)
@@ -16,7 +31,13 @@ typedef enum {
   SmartstrapCmdSetBaudRate,
   SmartstrapCmdSetTxEnabled,
   SmartstrapCmdWriteByte,
-  SmartstrapCmdWriteBreak
+  SmartstrapCmdWriteBreak,
+  // arg is the number of bytes to write from the start of the buffer set by pebble_set_tx_buffer()
+  SmartstrapCmdWriteBuffer,
+  // Same as SmartstrapCmdWriteBuffer, but the callback may return before the bytes are sent. Once
+  // the last byte is out, the transport disables TX itself and then calls pebble_tx_complete().
+  // This is only used (to end a frame) after async TX is enabled with pebble_set_tx_async().
+  SmartstrapCmdWriteBufferAsync
 } SmartstrapCmd;
 
 typedef enum {
@@ -48,15 +69,281 @@ typedef enum {
 } SmartstrapRequestType;
 
 
+typedef enum {
+  SmartstrapRequestMaskRead = 1 << SmartstrapRequestTypeRead,
+  SmartstrapRequestMaskWrite = 1 << SmartstrapRequestTypeWrite,
+  SmartstrapRequestMaskWriteRead = 1 << SmartstrapRequestTypeWriteRead,
+  SmartstrapRequestMaskAll = SmartstrapRequestMaskRead | SmartstrapRequestMaskWrite |
+                             SmartstrapRequestMaskWriteRead
+} SmartstrapRequestMask;
+
+typedef struct PebbleSerialContext PebbleSerialContext;
+typedef struct PebbleAttribute PebbleAttribute;
+
 typedef void (*SmartstrapCallback)(SmartstrapCmd cmd, uint32_t arg);
+typedef void (*SmartstrapContextCallback)(void *context, SmartstrapCmd cmd, uint32_t arg);
+// The last value of a delta encoded attribute which was sent to the watch. last_value must point to
+// max_length bytes.
+typedef struct {
+  uint8_t *last_value;
+  uint8_t sequence;
+} PebbleDeltaState;
+
+typedef void (*PebbleAttributeHandler)(PebbleSerialContext *ctx, const PebbleAttribute *attribute,
+                                       SmartstrapRequestType type, uint8_t *data, size_t length);
+
+typedef enum {
+  // data holds the next length bytes of the payload
+  PebbleStreamEventData,
+  // the whole frame was valid and length is the total length of the payload
+  PebbleStreamEventEnd,
+  // the frame was invalid (or a raw data frame went over its attribute's max_length), so everything
+  // passed for it so far should be thrown away
+  PebbleStreamEventAbort
+} PebbleStreamEvent;
+
+// Once set with pebble_set_stream_handler(), frames which are too long for the receive buffer are
+// passed to this in buffer sized chunks as they arrive rather than being dropped. The frame then
+// ends with either PebbleStreamEventEnd, after which a response can be sent with pebble_write(), or
+// PebbleStreamEventAbort. Streamed frames aren't returned from pebble_handle_bytes(). With an
+// attribute table, a request is only streamed if the table allows it; otherwise it's rejected once
+// it ends, the same as a request which fits. A raw data frame's length is only known as it arrives,
+// so it's aborted once it's longer than the table allows. This is called from wherever the bytes
+// are decoded, which is the RX ISR for pebble_decode_byte().
+typedef void (*PebbleStreamHandler)(PebbleSerialContext *ctx, PebbleStreamEvent event,
+                                    uint16_t service_id, uint16_t attribute_id,
+                                    const uint8_t *data, size_t length);
+
+// An entry in the table of attributes passed to pebble_set_attributes(). Requests for attributes
+// which aren't in the table, of a type which isn't in request_types, or with more than max_length
+// bytes of data are rejected by the library. Requests for the rest are passed to the handler, or
+// returned from pebble_handle_bytes() if the handler is NULL.
+//
+// If value is set, reads are answered by the library with the max_length bytes it points to. If
+// the value is updated from an ISR, point sequence at a counter and wrap the updates with
+// pebble_value_begin_update() and pebble_value_end_update() so that a torn value is never sent.
+// Such a value is copied into the payload buffer before it's sent, so every payload buffer must be
+// at least max_length bytes: pebble_set_attributes() rejects a table with a longer one, and
+// pebble_prepare_for_read() rejects a buffer which is too short for the table.
+// Setting delta as well lets the watch read just the bytes which changed since the last read (see
+// delta.h), in which case WriteRead requests must be allowed.
+struct PebbleAttribute {
+  uint16_t service_id;
+  uint16_t attribute_id;
+  PebbleAttributeHandler handler;
+  uint16_t max_length;
+  uint8_t request_types;
+  const void *value;
+  volatile uint8_t *sequence;
+  PebbleDeltaState *delta;
+};
+
+// The batch read service lets the watch read several value attributes with a single WriteRead of
+// PEBBLE_BATCH_READ_ATTRIBUTE_ID. The request is a list of (service_id, attribute_id) pairs and the
+// response has a PebbleBatchStatus byte and a length byte for each one, followed by that many bytes
+// of the attribute's value. It's enabled by adding PEBBLE_BATCH_READ_ATTRIBUTE() to the attributes.
+#ifndef PEBBLE_BATCH_SERVICE_ID
+#define PEBBLE_BATCH_SERVICE_ID 0xFFF0
+#endif
+#define PEBBLE_BATCH_READ_ATTRIBUTE_ID 0x0001
+#define PEBBLE_BATCH_READ_ATTRIBUTE(max_items) \
+  { PEBBLE_BATCH_SERVICE_ID, PEBBLE_BATCH_READ_ATTRIBUTE_ID, NULL, (max_items) * 4, \
+    SmartstrapRequestMaskWriteRead, NULL, NULL, NULL }
+
+typedef enum {
+  PebbleBatchStatusOk = 0,
+  // there's no such attribute, or it isn't a value attribute which can be read
+  PebbleBatchStatusNotSupported = 1,
+  // the value kept changing while it was being read, so the bytes which follow are all 0
+  PebbleBatchStatusBusy = 2
+} PebbleBatchStatus;
+
+#define PEBBLE_MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+static inline void pebble_value_begin_update(volatile uint8_t *sequence) {
+  (*sequence)++;
+  PEBBLE_MEMORY_BARRIER();
+}
+
+static inline void pebble_value_end_update(volatile uint8_t *sequence) {
+  PEBBLE_MEMORY_BARRIER();
+  (*sequence)++;
+}
+
+typedef struct {
+  uint8_t version;
+  uint32_t flags;
+  uint16_t profile;
+} PebbleFrameHeader;
+
+typedef struct {
+  PebbleFrameHeader header;
+  uint8_t service_header[PEBBLE_PAYLOAD_OVERHEAD];
+  uint8_t *payload;
+  uint8_t checksum;
+  size_t length;
+  size_t max_payload_length;
+  size_t stream_offset;
+  // a streamed request which the attribute table doesn't allow, so it isn't passed on
+  bool is_rejected;
+  uint8_t footer_byte;
+  bool should_drop;
+  bool is_read;
+  EncodingStreamingContext encoding_ctx;
+} PebbleFrameInfo;
+
+// The number of received frames which were dropped, by reason.
+typedef struct {
+  uint16_t header;    // bad version, flags or profile (including our own frames echoed back)
+  uint16_t overflow;  // longer than the payload buffer
+  uint16_t encoding;  // invalid escape sequence
+  uint16_t checksum;  // bad CRC
+  uint16_t length;    // too short, or the generic service length doesn't match
+  uint16_t no_buffer; // the application had all of the receive buffers
+} PebbleDropCounters;
+
+// All of the state for a single smartstrap link. The fields are private to the library; a context
+// is set up with pebble_ctx_init() and then passed to each of the pebble_ctx_*() functions.
+struct PebbleSerialContext {
+  SmartstrapContextCallback callback;
+  void *callback_context;
+  PebbleFrameInfo frame;
+  SmartstrapRequestType last_generic_service_type;
+  uint32_t last_message_time;
+  bool connected;
+  PebbleBaud current_baud;
+  PebbleBaud target_baud;
+  uint32_t current_time;
+  const uint16_t *supported_services;
+  uint8_t num_supported_services;
+  const PebbleAttribute *attributes;
+  uint8_t num_attributes;
+  struct {
+    bool can_respond;
+    // whether the watch is waiting for the response (it isn't for a raw data write)
+    bool is_awaited;
+    uint16_t service_id;
+    uint16_t attribute_id;
+    bool in_progress;
+    uint8_t parity;
+    uint16_t remaining;
+  } pending_response;
+  struct {
+    uint8_t *buffer;
+    size_t max_length;
+    size_t length;
+    bool is_async;
+    volatile bool is_busy;
+  } tx_buffer;
+  uint8_t control_payload[PEBBLE_CONTROL_PAYLOAD_LENGTH];
+  struct {
+    uint8_t *current;
+    size_t current_length;
+    uint8_t *buffers[PEBBLE_MAX_RX_BUFFERS];
+    size_t lengths[PEBBLE_MAX_RX_BUFFERS];
+    uint8_t start;
+    uint8_t count;
+  } rx_buffers;
+  PebbleDropCounters drop_counters;
+  PebbleStreamHandler stream_handler;
+  volatile bool frame_ready;
+  volatile bool rx_overrun;
+  struct {
+    struct {
+      uint16_t service_id;
+      uint16_t attribute_id;
+    } pending[PEBBLE_MAX_PENDING_NOTIFICATIONS];
+    uint8_t count;
+    bool in_flight;
+    uint32_t last_time;
+    uint16_t min_interval;
+  } notifications;
+};
+
+void pebble_ctx_init(PebbleSerialContext *ctx, SmartstrapContextCallback callback,
+                     void *callback_context, PebbleBaud baud, const uint16_t *services,
+                     uint8_t num_services);
+// Hands a payload buffer to the library. Buffers are filled in the order they are handed over, and
+// a buffer belongs to the application once its frame is returned until it is handed back again.
+// Returns false if the buffer is one the library already has.
+bool pebble_ctx_prepare_for_read(PebbleSerialContext *ctx, uint8_t *buffer, size_t length);
+// Returns false (and keeps the old table) if a payload buffer which has been handed over is too
+// short for one of the sequence guarded values.
+bool pebble_ctx_set_attributes(PebbleSerialContext *ctx, PebbleAttribute *attributes,
+                               uint8_t num_attributes);
+void pebble_ctx_set_stream_handler(PebbleSerialContext *ctx, PebbleStreamHandler handler);
+// Has the library build up the bytes it sends in the given buffer and send them with
+// SmartstrapCmdWriteBuffer, rather than one at a time with SmartstrapCmdWriteByte. A NULL buffer
+// (or a length of 0) goes back to sending a byte at a time.
+void pebble_ctx_set_tx_buffer(PebbleSerialContext *ctx, uint8_t *buffer, size_t length);
+void pebble_ctx_set_tx_async(PebbleSerialContext *ctx, bool enabled);
+void pebble_ctx_tx_complete(PebbleSerialContext *ctx);
+bool pebble_ctx_is_tx_busy(PebbleSerialContext *ctx);
+bool pebble_ctx_handle_byte(PebbleSerialContext *ctx, uint8_t data, uint16_t *service_id,
+                            uint16_t *attribute_id, size_t *length, SmartstrapRequestType *type,
+                            uint32_t time_ms);
+bool pebble_ctx_handle_bytes(PebbleSerialContext *ctx, const uint8_t *data, size_t length,
+                             size_t *consumed, uint16_t *service_id, uint16_t *attribute_id,
+                             size_t *payload_length, SmartstrapRequestType *type,
+                             uint32_t time_ms);
+// These split pebble_ctx_handle_byte() in two so the decoding can be done from an RX ISR.
+// pebble_ctx_decode_byte() only decodes and stores the byte, and returns true once there's a frame
+// for pebble_ctx_handle_ready_frame() to handle from the main loop. Bytes which arrive before then
+// are dropped.
+bool pebble_ctx_decode_byte(PebbleSerialContext *ctx, uint8_t data);
+bool pebble_ctx_handle_ready_frame(PebbleSerialContext *ctx, uint16_t *service_id,
+                                   uint16_t *attribute_id, size_t *length,
+                                   SmartstrapRequestType *type, uint32_t time_ms);
+bool pebble_ctx_write(PebbleSerialContext *ctx, bool success, const uint8_t *buffer,
+                      uint16_t length);
+// These send a response of the given length in pieces, so it never has to be in RAM all at once.
+// The chunks are encoded as they are written and must add up to exactly length bytes; a short
+// response is padded with zeros and pebble_ctx_write_end() returns false.
+bool pebble_ctx_write_begin(PebbleSerialContext *ctx, bool success, uint16_t length);
+bool pebble_ctx_write_chunk(PebbleSerialContext *ctx, const uint8_t *data, uint16_t length);
+bool pebble_ctx_write_end(PebbleSerialContext *ctx);
+// Sends the response compressed with lz_compress() (see lz.h), or as-is if it doesn't get any
+// smaller, so the watch has to decode it with lz_decompress(). Returns false without sending
+// anything if that leaves no room for the format byte in a response.
+bool pebble_ctx_write_compressed(PebbleSerialContext *ctx, bool success, const uint8_t *buffer,
+                                 uint16_t length);
+// Queues a notification for the given attribute. Notifications are sent one at a time (waiting for
+// the watch to read which attribute each one is for) and a notification which is already queued
+// isn't added again. Nothing is sent while the watch is waiting for a response, so a queued
+// notification goes out from a later call once the response has been written. Returns false if the
+// queue is full.
+bool pebble_ctx_notify(PebbleSerialContext *ctx, uint16_t service_id, uint16_t attribute_id,
+                       uint32_t time_ms);
+void pebble_ctx_set_notify_interval(PebbleSerialContext *ctx, uint16_t interval_ms);
+bool pebble_ctx_is_connected(PebbleSerialContext *ctx, uint32_t time);
+void pebble_ctx_get_drop_counters(PebbleSerialContext *ctx, PebbleDropCounters *counters);
 
+// These operate on a default context which is shared by the whole program.
 void pebble_init(SmartstrapCallback callback, PebbleBaud baud, const uint16_t *services,
                  uint8_t num_services);
-void pebble_prepare_for_read(uint8_t *buffer, size_t length);
+bool pebble_prepare_for_read(uint8_t *buffer, size_t length);
+bool pebble_set_attributes(PebbleAttribute *attributes, uint8_t num_attributes);
+void pebble_set_stream_handler(PebbleStreamHandler handler);
+void pebble_set_tx_buffer(uint8_t *buffer, size_t length);
+void pebble_set_tx_async(bool enabled);
+void pebble_tx_complete(void);
+bool pebble_is_tx_busy(void);
 bool pebble_handle_byte(uint8_t data, uint16_t *service_id, uint16_t *attribute_id, size_t *length,
                         SmartstrapRequestType *type, uint32_t time_ms);
+bool pebble_handle_bytes(const uint8_t *data, size_t length, size_t *consumed,
+                         uint16_t *service_id, uint16_t *attribute_id, size_t *payload_length,
+                         SmartstrapRequestType *type, uint32_t time_ms);
+bool pebble_decode_byte(uint8_t data);
+bool pebble_handle_ready_frame(uint16_t *service_id, uint16_t *attribute_id, size_t *length,
+                               SmartstrapRequestType *type, uint32_t time_ms);
 bool pebble_write(bool success, const uint8_t *buffer, uint16_t length);
-void pebble_notify(uint16_t service_id, uint16_t attribute_id);
+bool pebble_write_begin(bool success, uint16_t length);
+bool pebble_write_chunk(const uint8_t *data, uint16_t length);
+bool pebble_write_end(void);
+bool pebble_write_compressed(bool success, const uint8_t *buffer, uint16_t length);
+bool pebble_notify(uint16_t service_id, uint16_t attribute_id, uint32_t time_ms);
+void pebble_set_notify_interval(uint16_t interval_ms);
 bool pebble_is_connected(uint32_t time);
+void pebble_get_drop_counters(PebbleDropCounters *counters);
 
 #endif // __PEBBLE_SERIAL_H__
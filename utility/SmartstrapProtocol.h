@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * Definitions of the smartstrap wire protocol which are shared by both ends of the link. These are
+ * used by the PebbleSerial library (the slave side) and can be used by anything which implements
+ * the watch (master) side of the protocol, such as a simulator.
+ */
+
+#include <stdint.h>
+
+#define PROTOCOL_VERSION              1
+#define GENERIC_SERVICE_VERSION       1
+
+#define FRAME_MIN_LENGTH              8
+#define FRAME_VERSION_OFFSET          0
+#define FRAME_FLAGS_OFFSET            1
+#define FRAME_PROFILE_OFFSET          5
+#define FRAME_PAYLOAD_OFFSET          7
+
+#define FLAGS_IS_READ_OFFSET          0
+#define FLAGS_IS_MASTER_OFFSET        1
+#define FLAGS_IS_NOTIFICATION_OFFSET  2
+#define FLAGS_RESERVED_OFFSET         3
+#define FLAGS_IS_READ_MASK            (0x1 << FLAGS_IS_READ_OFFSET)
+#define FLAGS_IS_MASTER_MASK          (0x1 << FLAGS_IS_MASTER_OFFSET)
+#define FLAGS_IS_NOTIFICATION_MASK    (0x1 << FLAGS_IS_NOTIFICATION_OFFSET)
+#define FLAGS_RESERVED_MASK           (~(FLAGS_IS_READ_MASK | \
+                                         FLAGS_IS_MASTER_MASK | \
+                                         FLAGS_IS_NOTIFICATION_MASK))
+#define FLAGS_GET(flags, mask, offset) (((flags) & mask) >> offset)
+#define FLAGS_SET(flags, mask, offset, value) \
+  (flags) = ((flags) & ~mask) | (((value) << offset) & mask)
+
+#define MANAGEMENT_SERVICE_ID                   0x0101
+#define MANAGEMENT_SERVICE_DISCOVERY_ATTRIBUTE  0x0001
+#define MANAGEMENT_NOTIFICATION_INFO_ATTRIBUTE  0x0002
+
+typedef enum {
+  SmartstrapProfileInvalid = 0x00,
+  SmartstrapProfileLinkControl = 0x01,
+  SmartstrapProfileRawData = 0x02,
+  SmartstrapProfileGenericService = 0x03,
+  NumSmartstrapProfiles
+} SmartstrapProfile;
+
+typedef enum {
+  LinkControlTypeInvalid = 0,
+  LinkControlTypeStatus = 1,
+  LinkControlTypeProfiles = 2,
+  LinkControlTypeBaud = 3,
+  NumLinkControlTypes
+} LinkControlType;
+
+typedef enum {
+  LinkControlStatusOk = 0,
+  LinkControlStatusBaudRate = 1,
+  LinkControlStatusDisconnect = 2
+} LinkControlStatus;
+
+typedef struct __attribute__((packed)) {
+  uint8_t version;
+  uint16_t service_id;
+  uint16_t attribute_id;
+  uint8_t type;
+  uint8_t error;
+  uint16_t length;
+  uint8_t data[];
+} GenericServicePayload;
@@ -13,6 +13,13 @@
 #define cbi(sfr, bit) (sfr &= ~_BV(bit))
 #define sbi(sfr, bit) (sfr |= _BV(bit))
 
+// Async TX in hardware mode (see set_tx_async()) sends each byte from the UART's TX complete
+// interrupt, which the sketch then can't use for anything else. Define this to 1 (here or as a
+// compiler flag, so the library and the sketch agree) to turn it on where the board supports it.
+#ifndef PEBBLE_HARDWARE_TX_ASYNC
+#define PEBBLE_HARDWARE_TX_ASYNC 0
+#endif
+
 // The board-specific variables are defined below
 #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega2560__)
 /* Arduino Mega, Teensy 2.0, etc */
@@ -37,6 +44,22 @@ static inline void board_set_even_parity(bool enabled) {
     bitClear(UCSR1C, UPM11);
   }
 }
+#if PEBBLE_HARDWARE_TX_ASYNC && !defined(CORE_TEENSY)
+// The Teensy core uses the TX complete interrupt itself, so async TX isn't supported there
+#define BOARD_TX_COMPLETE_VECT USART1_TX_vect
+#endif
+static inline void board_write_async_begin(uint8_t data) {
+  // clear any old TX complete flag (by writing a one to it) before sending the first byte
+  bitSet(UCSR1A, TXC1);
+  UDR1 = data;
+  bitSet(UCSR1B, TXCIE1);
+}
+static inline void board_write_async_next(uint8_t data) {
+  UDR1 = data;
+}
+static inline void board_write_async_end(void) {
+  bitClear(UCSR1B, TXCIE1);
+}
 
 #elif defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
 /* Arduino Uno, etc */
@@ -61,6 +84,21 @@ static inline void board_set_even_parity(bool enabled) {
     bitClear(UCSR0C, UPM01);
   }
 }
+#if PEBBLE_HARDWARE_TX_ASYNC
+#define BOARD_TX_COMPLETE_VECT USART_TX_vect
+#endif
+static inline void board_write_async_begin(uint8_t data) {
+  // clear any old TX complete flag (by writing a one to it) before sending the first byte
+  bitSet(UCSR0A, TXC0);
+  UDR0 = data;
+  bitSet(UCSR0B, TXCIE0);
+}
+static inline void board_write_async_next(uint8_t data) {
+  UDR0 = data;
+}
+static inline void board_write_async_end(void) {
+  bitClear(UCSR0B, TXCIE0);
+}
 #elif defined(__MK20DX256__) || defined(__MK20DX128__)
 /* Teensy 3.0, Teensy 3.1, etc */
 #define BOARD_SERIAL Serial1
@@ -68,7 +106,7 @@ static inline void board_begin(void) {
   // configure TX as open-drain
   CORE_PIN1_CONFIG |= PORT_PCR_ODE;
 }
-static inline void board_set_tx_enabled(bool enabled) {
+static inline void board_set_tx_enabled(bool) {
   // the TX and RX are tied together and we'll just drop any loopback frames
 }
 static inline void board_set_even_parity(bool enabled) {
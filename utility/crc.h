@@ -1,5 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+
+// Set to 0 to use a 16-byte nibble lookup table instead of the 256-byte byte lookup table on parts
+// which are short on flash.
+#ifndef CRC8_USE_FULL_TABLE
+#define CRC8_USE_FULL_TABLE 1
+#endif
 
 void crc8_calculate_byte_streaming(const uint8_t data, uint8_t *crc);
+void crc8_calculate_buffer(const uint8_t *data, size_t length, uint8_t *crc);
@@ -0,0 +1,73 @@
+#include "delta.h"
+
+#include <string.h>
+
+#define RUN_HEADER_LENGTH 2
+
+size_t delta_next_run(const uint8_t *value, const uint8_t *last_value, size_t length,
+                      size_t offset, size_t *run_length) {
+  while ((offset < length) && (value[offset] == last_value[offset])) {
+    offset++;
+  }
+  if (offset == length) {
+    *run_length = 0;
+    return length;
+  }
+  // end is just past the last changed byte in the run
+  size_t end = offset + 1;
+  size_t i;
+  for (i = end; i < length; i++) {
+    if (value[i] != last_value[i]) {
+      if (i + 1 - offset > DELTA_MAX_RUN_LENGTH) {
+        break;
+      }
+      end = i + 1;
+    } else if (i + 1 - end > RUN_HEADER_LENGTH) {
+      // it's cheaper to start a new run than to send these unchanged bytes
+      break;
+    }
+  }
+  *run_length = end - offset;
+  return offset;
+}
+
+bool delta_apply(uint8_t *value, size_t length, uint8_t *sequence, const uint8_t *data,
+                 size_t data_length) {
+  if (data_length < 2) {
+    *sequence = 0;
+    return false;
+  }
+  const uint8_t new_sequence = data[0];
+  const uint8_t format = data[1];
+  data += 2;
+  data_length -= 2;
+  if (format == DELTA_FORMAT_FULL) {
+    if (data_length != length) {
+      *sequence = 0;
+      return false;
+    }
+    memcpy(value, data, length);
+  } else if (format == DELTA_FORMAT_RUNS) {
+    // validate all of the runs before changing anything
+    size_t i = 0;
+    while (i < data_length) {
+      if ((data_length - i < RUN_HEADER_LENGTH) ||
+          ((size_t)data[i] + data[i + 1] > length) ||
+          (data[i + 1] > data_length - i - RUN_HEADER_LENGTH)) {
+        *sequence = 0;
+        return false;
+      }
+      i += RUN_HEADER_LENGTH + data[i + 1];
+    }
+    i = 0;
+    while (i < data_length) {
+      memcpy(&value[data[i]], &data[i + RUN_HEADER_LENGTH], data[i + 1]);
+      i += RUN_HEADER_LENGTH + data[i + 1];
+    }
+  } else {
+    *sequence = 0;
+    return false;
+  }
+  *sequence = new_sequence;
+  return true;
+}
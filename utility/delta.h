@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * The format of delta encoded attribute reads (see PebbleAttribute::delta). Like lz.c, this file
+ * and delta.c have no dependencies so they can be copied into a Pebble app to apply the deltas.
+ *
+ * The watch requests a delta with a WriteRead of one byte: the sequence number of the copy of the
+ * value it already has, or 0 if it doesn't have one. The response starts with the sequence number
+ * of the new value and a DELTA_FORMAT_* byte. A full value follows DELTA_FORMAT_FULL. Otherwise,
+ * there are zero or more runs of changed bytes, each of which is an offset byte, a length byte and
+ * then that many bytes of the new value. The strap only sends a delta when the watch's sequence
+ * number matches the last value it sent, so a lost response just means a full value next time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DELTA_FORMAT_FULL 0
+#define DELTA_FORMAT_RUNS 1
+
+// the offsets are a single byte, so longer values are always sent in full
+#define DELTA_MAX_VALUE_LENGTH 256
+#define DELTA_MAX_RUN_LENGTH 255
+
+// Finds the next run of bytes which differ between value and last_value, starting from offset.
+// Runs separated by fewer unchanged bytes than a run header are merged. Returns the offset of the
+// run and sets run_length, or returns length (and sets run_length to 0) if there are no more.
+size_t delta_next_run(const uint8_t *value, const uint8_t *last_value, size_t length,
+                      size_t offset, size_t *run_length);
+// Applies a response to the watch's copy of the value and updates its sequence number. Returns
+// false if the response is invalid, in which case the sequence number is reset so that the next
+// request gets the full value.
+bool delta_apply(uint8_t *value, size_t length, uint8_t *sequence, const uint8_t *data,
+                 size_t data_length);
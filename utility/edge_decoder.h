@@ -0,0 +1,111 @@
+#pragma once
+
+/*
+ * This reconstructs UART bytes (8N1, LSB first) from the times of the edges on the line, as
+ * captured by a hardware timer. Each bit is sampled at its middle, the same as a UART would, by
+ * taking the level of the line between the edges either side of that point. There is no edge at
+ * the end of a byte which ends in a 1, so edge_decoder_timeout() should be called once
+ * EDGE_DECODER_STOP_TICKS() have passed since the start bit (or the next start bit arrives).
+ *
+ * Times are in timer ticks and are allowed to wrap, as long as a whole byte fits in 16 bits.
+ * Everything is inline since it is called from ISRs.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// the number of bits in a byte including the start and stop bits
+#define EDGE_DECODER_NUM_BITS 10
+// The length of a bit in ticks of a timer running at the given rate. This is rounded to the nearest
+// tick, since at the fastest baud rates a tick is a few percent of a bit.
+#define EDGE_DECODER_BIT_TICKS(ticks_per_sec, baud) (((ticks_per_sec) + (baud) / 2) / (baud))
+// the time from the start bit to the middle of the stop bit
+#define EDGE_DECODER_STOP_TICKS(dec) ((dec)->bit_ticks * (EDGE_DECODER_NUM_BITS - 1) + \
+                                      (dec)->bit_ticks / 2)
+
+typedef struct {
+  uint16_t bit_ticks;
+  uint16_t start_time;
+  uint16_t next_sample;
+  uint8_t data;
+  uint8_t num_bits;
+  bool is_receiving;
+  bool level;
+  uint8_t framing_errors;
+} EdgeDecoder;
+
+static inline void edge_decoder_init(EdgeDecoder *dec, uint16_t bit_ticks) {
+  // this is also used from C++, so it doesn't use a designated initializer
+  memset(dec, 0, sizeof(*dec));
+  dec->bit_ticks = bit_ticks;
+  dec->level = true;
+}
+
+// Forgets about any byte in progress, for when edges have been missed (i.e. while transmitting).
+static inline void edge_decoder_reset(EdgeDecoder *dec) {
+  dec->is_receiving = false;
+  dec->level = true;
+}
+
+// Takes the samples for all of the bits which end before the given time, and returns true if this
+// completed a byte.
+static inline bool edge_decoder_sample(EdgeDecoder *dec, uint16_t elapsed, uint8_t *byte) {
+  while ((dec->num_bits < EDGE_DECODER_NUM_BITS) && (elapsed > dec->next_sample)) {
+    if (dec->num_bits == 0) {
+      if (dec->level) {
+        // the start bit didn't last long enough, so this was just a glitch
+        dec->is_receiving = false;
+        return false;
+      }
+    } else if (dec->num_bits < EDGE_DECODER_NUM_BITS - 1) {
+      dec->data >>= 1;
+      if (dec->level) {
+        dec->data |= 0x80;
+      }
+    }
+    dec->num_bits++;
+    dec->next_sample += dec->bit_ticks;
+  }
+  if (dec->num_bits < EDGE_DECODER_NUM_BITS) {
+    return false;
+  }
+  dec->is_receiving = false;
+  if (!dec->level) {
+    // the stop bit is missing (this is also what a break looks like)
+    dec->framing_errors++;
+    return false;
+  }
+  *byte = dec->data;
+  return true;
+}
+
+// Handles an edge at the given time which left the line at the given level, and returns true if
+// this completed a byte (which happens when the edge is the start of the next byte).
+static inline bool edge_decoder_handle_edge(EdgeDecoder *dec, uint16_t time, bool level,
+                                            uint8_t *byte) {
+  bool is_complete = false;
+  if (dec->is_receiving) {
+    // everything up to this edge was at the previous level
+    is_complete = edge_decoder_sample(dec, time - dec->start_time, byte);
+  }
+  dec->level = level;
+  if (!dec->is_receiving && !level) {
+    // this is a start bit
+    dec->is_receiving = true;
+    dec->start_time = time;
+    dec->next_sample = dec->bit_ticks / 2;
+    dec->num_bits = 0;
+    dec->data = 0;
+  }
+  return is_complete;
+}
+
+// Finishes the current byte based on the current level of the line, and returns true if there was
+// a valid byte.
+static inline bool edge_decoder_timeout(EdgeDecoder *dec, uint8_t *byte) {
+  if (!dec->is_receiving) {
+    return false;
+  }
+  return edge_decoder_sample(dec, UINT16_MAX, byte);
+}
@@ -1,5 +1,13 @@
 #include "encoding.h"
 
+#include <string.h>
+
+#if ENCODING_WORD_SCAN && ENCODING_SIMD_SCAN && defined(__SSE2__)
+#include <emmintrin.h>
+#elif ENCODING_WORD_SCAN && ENCODING_SIMD_SCAN && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 void encoding_streaming_decode_reset(EncodingStreamingContext *ctx) {
   ctx->escape = false;
 }
@@ -44,3 +52,63 @@ bool encoding_encode(uint8_t *data) {
   }
   return false;
 }
+
+static size_t prv_find_special_bytewise(const uint8_t *data, size_t length) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    if (data[i] == ENCODING_FLAG || data[i] == ENCODING_ESCAPE) {
+      break;
+    }
+  }
+  return i;
+}
+
+#if ENCODING_WORD_SCAN
+typedef uintptr_t EncodingWord;
+#define WORD_REPEAT(byte) ((EncodingWord)-1 / 0xFF * (byte))
+
+static inline bool prv_word_has_byte(EncodingWord word, uint8_t byte) {
+  // the word contains the byte if XORing it in leaves a zero byte
+  const EncodingWord x = word ^ WORD_REPEAT(byte);
+  return ((x - WORD_REPEAT(0x01)) & ~x & WORD_REPEAT(0x80)) != 0;
+}
+#endif
+
+size_t encoding_find_special(const uint8_t *data, size_t length) {
+  size_t i = 0;
+#if ENCODING_WORD_SCAN
+#if ENCODING_SIMD_SCAN && defined(__SSE2__)
+  const __m128i flag = _mm_set1_epi8((char)ENCODING_FLAG);
+  const __m128i escape = _mm_set1_epi8((char)ENCODING_ESCAPE);
+  for (; length - i >= sizeof(__m128i); i += sizeof(__m128i)) {
+    const __m128i block = _mm_loadu_si128((const __m128i *)&data[i]);
+    const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, flag),
+                                                    _mm_cmpeq_epi8(block, escape)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#elif ENCODING_SIMD_SCAN && defined(__ARM_NEON)
+  const uint8x16_t flag = vdupq_n_u8(ENCODING_FLAG);
+  const uint8x16_t escape = vdupq_n_u8(ENCODING_ESCAPE);
+  for (; length - i >= sizeof(uint8x16_t); i += sizeof(uint8x16_t)) {
+    const uint8x16_t block = vld1q_u8(&data[i]);
+    const uint64x2_t mask = vreinterpretq_u64_u8(vorrq_u8(vceqq_u8(block, flag),
+                                                          vceqq_u8(block, escape)));
+    if (vgetq_lane_u64(mask, 0) | vgetq_lane_u64(mask, 1)) {
+      // the byte-wise scan below will find exactly where it is
+      break;
+    }
+  }
+#endif
+  for (; length - i >= sizeof(EncodingWord); i += sizeof(EncodingWord)) {
+    EncodingWord word;
+    memcpy(&word, &data[i], sizeof(word));
+    if (prv_word_has_byte(word, ENCODING_FLAG) || prv_word_has_byte(word, ENCODING_ESCAPE)) {
+      // the byte-wise scan below will find exactly where it is
+      break;
+    }
+  }
+#endif
+  return i + prv_find_special_bytewise(&data[i], length - i);
+}
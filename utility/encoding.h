@@ -2,6 +2,22 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+// Set to 1 to scan for special bytes a word (or SIMD register) at a time rather than a byte at a
+// time. This is only a win on 32/64-bit targets, so it is enabled by default only on those.
+#ifndef ENCODING_WORD_SCAN
+#if UINTPTR_MAX > 0xFFFF
+#define ENCODING_WORD_SCAN 1
+#else
+#define ENCODING_WORD_SCAN 0
+#endif
+#endif
+
+// Set to 0 to leave out the SSE2 / NEON scan and only scan a word at a time.
+#ifndef ENCODING_SIMD_SCAN
+#define ENCODING_SIMD_SCAN 1
+#endif
 
 static const uint8_t ENCODING_FLAG = 0x7E;
 static const uint8_t ENCODING_ESCAPE = 0x7D;
@@ -15,3 +31,4 @@ void encoding_streaming_decode_reset(EncodingStreamingContext *ctx);
 bool encoding_streaming_decode(EncodingStreamingContext *ctx, uint8_t *data, bool *complete,
                            bool *is_invalid);
 bool encoding_encode(uint8_t *data);
+size_t encoding_find_special(const uint8_t *data, size_t length);
@@ -0,0 +1,114 @@
+#include "lz.h"
+
+#include <string.h>
+
+#if LZ_WINDOW_SIZE > 256
+#error "LZ_WINDOW_SIZE must fit in the one byte distance"
+#endif
+
+static size_t prv_find_match(const uint8_t *data, size_t length, size_t index, size_t *distance) {
+  const size_t window = (index < LZ_WINDOW_SIZE) ? index : LZ_WINDOW_SIZE;
+  size_t max_length = length - index;
+  if (max_length > LZ_MAX_MATCH) {
+    max_length = LZ_MAX_MATCH;
+  }
+  size_t best_length = 0;
+  size_t d;
+  for (d = 1; d <= window; d++) {
+    const uint8_t *candidate = &data[index - d];
+    size_t match_length = 0;
+    // the match can run on past index, which repeats the last d bytes
+    while ((match_length < max_length) && (candidate[match_length] == data[index + match_length])) {
+      match_length++;
+    }
+    if (match_length > best_length) {
+      best_length = match_length;
+      *distance = d;
+      if (match_length == max_length) {
+        break;
+      }
+    }
+  }
+  return best_length;
+}
+
+size_t lz_compress(const uint8_t *data, size_t length, LzWriteCallback write, void *context) {
+  // the tokens for a group are collected here so that its flags byte can go first
+  uint8_t group[1 + 8 * 2];
+  size_t group_length = 1;
+  uint8_t num_tokens = 0;
+  size_t total_length = 0;
+  group[0] = 0;
+  size_t i = 0;
+  while (i < length) {
+    size_t distance = 0;
+    const size_t match_length = prv_find_match(data, length, i, &distance);
+    if (match_length >= LZ_MIN_MATCH) {
+      group[0] |= 1 << num_tokens;
+      group[group_length++] = distance - 1;
+      group[group_length++] = match_length - LZ_MIN_MATCH;
+      i += match_length;
+    } else {
+      group[group_length++] = data[i++];
+    }
+    num_tokens++;
+    if ((num_tokens == 8) || (i == length)) {
+      if (write) {
+        write(context, group, group_length);
+      }
+      total_length += group_length;
+      group[0] = 0;
+      group_length = 1;
+      num_tokens = 0;
+    }
+  }
+  return total_length;
+}
+
+bool lz_decompress(const uint8_t *data, size_t length, uint8_t *output, size_t max_output_length,
+                   size_t *output_length) {
+  if (length == 0) {
+    return false;
+  } else if (data[0] == LZ_FORMAT_STORED) {
+    if (length - 1 > max_output_length) {
+      return false;
+    }
+    memcpy(output, &data[1], length - 1);
+    *output_length = length - 1;
+    return true;
+  } else if (data[0] != LZ_FORMAT_COMPRESSED) {
+    return false;
+  }
+
+  size_t in = 1;
+  size_t out = 0;
+  while (in < length) {
+    const uint8_t flags = data[in++];
+    uint8_t token;
+    for (token = 0; (token < 8) && (in < length); token++) {
+      if (flags & (1 << token)) {
+        if (length - in < 2) {
+          return false;
+        }
+        const size_t distance = (size_t)data[in++] + 1;
+        const size_t match_length = (size_t)data[in++] + LZ_MIN_MATCH;
+        if ((distance > out) || (match_length > max_output_length - out)) {
+          return false;
+        }
+        // copy a byte at a time since the source can overlap what's being written
+        size_t j;
+        for (j = 0; j < match_length; j++) {
+          output[out] = output[out - distance];
+          out++;
+        }
+      } else {
+        if (out == max_output_length) {
+          return false;
+        }
+        output[out++] = data[in++];
+      }
+    }
+  }
+  *output_length = out;
+  return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * A small LZ77-style codec for response payloads. The compressor needs no window buffer (matches
+ * are found in the input itself) and only a few bytes of state, and the decompressor has no
+ * dependencies, so this file and lz.c can be copied into a Pebble app to decode the payloads sent
+ * by pebble_write_compressed().
+ *
+ * The compressed data is a series of groups, each of which is a flags byte followed by up to 8
+ * tokens. Bit n of the flags byte (starting from the LSB) says whether token n is a literal byte
+ * (0) or a match (1). A match is two bytes: the distance back to copy from minus 1, and the length
+ * of the copy minus LZ_MIN_MATCH. The copy may overlap the bytes it produces.
+ *
+ * A payload from pebble_write_compressed() starts with one of the LZ_FORMAT_* values, since data
+ * which doesn't compress is sent as-is.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// How far back the compressor looks for matches (at most 256). A bigger window finds more matches
+// but the compressor's time per byte grows with it.
+#ifndef LZ_WINDOW_SIZE
+#define LZ_WINDOW_SIZE 128
+#endif
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 255)
+
+#define LZ_FORMAT_STORED 0
+#define LZ_FORMAT_COMPRESSED 1
+
+typedef void (*LzWriteCallback)(void *context, const uint8_t *data, size_t length);
+
+// Compresses the data, passing the output to write in pieces, and returns the compressed length.
+// If write is NULL, this just returns the length.
+size_t lz_compress(const uint8_t *data, size_t length, LzWriteCallback write, void *context);
+// Decodes a payload from pebble_write_compressed() (including its format byte). Returns false if
+// it's invalid or doesn't fit in the output buffer.
+bool lz_decompress(const uint8_t *data, size_t length, uint8_t *output, size_t max_output_length,
+                   size_t *output_length);
@@ -0,0 +1,225 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+/*
+ * This file contains the transports which ArduinoPebbleSerialT can be specialized for. Each one is
+ * a struct of static inline functions, so the calls made by the protocol loop are resolved at
+ * compile time and only the transport which is actually used ends up in flash.
+ */
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "board.h"
+#include "OneWireSoftSerial.h"
+extern "C" {
+#include "PebbleSerial.h"
+};
+
+#ifdef BOARD_TX_COMPLETE_VECT
+// These are defined in ArduinoPebbleSerial.cpp along with the TX complete ISR.
+void hardware_transport_write_async(const uint8_t *buffer, size_t length);
+#endif
+
+// The board's UART, which requires an external open-drain buffer (see board.h).
+struct HardwareSerialTransport {
+  static inline void begin(uint32_t baud) {
+    if (baud == 57600) {
+      // The Arduino library intentionally uses bad prescalers for a baud rate of exactly 57600 so
+      // we just increase it by 1 to prevent it from doing that.
+      baud++;
+    }
+    BOARD_SERIAL.begin(baud);
+    board_begin();
+  }
+  static inline void set_tx_enabled(bool enabled) {
+    if (!enabled) {
+      BOARD_SERIAL.flush();
+    }
+    board_set_tx_enabled(enabled);
+  }
+  static inline void write(uint8_t data) {
+    BOARD_SERIAL.write(data);
+  }
+  static inline void write(const uint8_t *buffer, size_t length) {
+    BOARD_SERIAL.write(buffer, length);
+  }
+  static inline void flush(void) {
+    BOARD_SERIAL.flush();
+  }
+  static inline void write_break(void) {
+    board_set_even_parity(true);
+    BOARD_SERIAL.write((uint8_t)0);
+    // need to flush before changing parity
+    BOARD_SERIAL.flush();
+    board_set_even_parity(false);
+  }
+  static inline bool supports_async(void) {
+#ifdef BOARD_TX_COMPLETE_VECT
+    return true;
+#else
+    return false;
+#endif
+  }
+  static inline void write_async(const uint8_t *buffer, size_t length) {
+#ifdef BOARD_TX_COMPLETE_VECT
+    hardware_transport_write_async(buffer, length);
+#else
+    // never called, since supports_async() is false
+    (void)buffer;
+    (void)length;
+#endif
+  }
+  static inline bool supports_rx_callback(void) {
+    // the RX interrupt belongs to BOARD_SERIAL
+    return false;
+  }
+  static inline void set_rx_callback(void (*)(uint8_t)) {
+  }
+  static inline int available(void) {
+    return BOARD_SERIAL.available();
+  }
+  static inline uint8_t read(void) {
+    return (uint8_t)BOARD_SERIAL.read();
+  }
+};
+
+// OneWireSoftSerial on whichever pin it was last begun on.
+struct OneWireTransport {
+  static inline void set_tx_enabled(bool enabled) {
+    OneWireSoftSerial::set_tx_enabled(enabled);
+  }
+  static inline void write(uint8_t data) {
+    OneWireSoftSerial::write(data);
+  }
+  static inline void write(const uint8_t *buffer, size_t length) {
+    OneWireSoftSerial::write(buffer, length);
+  }
+  static inline void flush(void) {
+    // writes have either finished or are queued ahead of any async write
+  }
+  static inline void write_break(void) {
+    OneWireSoftSerial::write(0, true /* is_break */);
+  }
+  static inline bool supports_async(void) {
+    // the software serial can only do this when it's transmitting from a timer
+    return _SS_TX_TIMER;
+  }
+  static inline void write_async(const uint8_t *buffer, size_t length) {
+    OneWireSoftSerial::write_async(buffer, length, pebble_tx_complete);
+  }
+  static inline bool supports_rx_callback(void) {
+#ifdef __arm__
+    // OneWireSoftSerial is only a stub on ARM
+    return false;
+#else
+    return true;
+#endif
+  }
+  static inline void set_rx_callback(void (*callback)(uint8_t data)) {
+    OneWireSoftSerial::set_rx_callback(callback);
+  }
+  static inline int available(void) {
+    return OneWireSoftSerial::available();
+  }
+  static inline uint8_t read(void) {
+    return (uint8_t)OneWireSoftSerial::read();
+  }
+};
+
+// OneWireSoftSerial on a pin which is fixed at compile time.
+template <uint8_t Pin>
+struct SoftwareSerialTransport : OneWireTransport {
+  static inline void begin(uint32_t baud) {
+    OneWireSoftSerial::begin(Pin, baud);
+  }
+};
+
+// Picks between the hardware and software serial at runtime, for ArduinoPebbleSerial's
+// begin_hardware() and begin_software().
+struct RuntimeTransport {
+  static bool s_is_hardware;
+  static uint8_t s_pin;
+
+  static inline void begin(uint32_t baud) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::begin(baud);
+    } else {
+      OneWireSoftSerial::begin(s_pin, baud);
+    }
+  }
+  static inline void set_tx_enabled(bool enabled) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::set_tx_enabled(enabled);
+    } else {
+      OneWireTransport::set_tx_enabled(enabled);
+    }
+  }
+  static inline void write(uint8_t data) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::write(data);
+    } else {
+      OneWireTransport::write(data);
+    }
+  }
+  static inline void write(const uint8_t *buffer, size_t length) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::write(buffer, length);
+    } else {
+      OneWireTransport::write(buffer, length);
+    }
+  }
+  static inline void flush(void) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::flush();
+    }
+  }
+  static inline void write_break(void) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::write_break();
+    } else {
+      OneWireTransport::write_break();
+    }
+  }
+  static inline bool supports_async(void) {
+    if (s_is_hardware) {
+      return HardwareSerialTransport::supports_async();
+    } else {
+      return OneWireTransport::supports_async();
+    }
+  }
+  static inline void write_async(const uint8_t *buffer, size_t length) {
+    if (s_is_hardware) {
+      HardwareSerialTransport::write_async(buffer, length);
+    } else {
+      OneWireTransport::write_async(buffer, length);
+    }
+  }
+  static inline bool supports_rx_callback(void) {
+    if (s_is_hardware) {
+      return HardwareSerialTransport::supports_rx_callback();
+    } else {
+      return OneWireTransport::supports_rx_callback();
+    }
+  }
+  static inline void set_rx_callback(void (*callback)(uint8_t data)) {
+    if (!s_is_hardware) {
+      OneWireTransport::set_rx_callback(callback);
+    }
+  }
+  static inline int available(void) {
+    if (s_is_hardware) {
+      return HardwareSerialTransport::available();
+    } else {
+      return OneWireTransport::available();
+    }
+  }
+  static inline uint8_t read(void) {
+    if (s_is_hardware) {
+      return HardwareSerialTransport::read();
+    } else {
+      return OneWireTransport::read();
+    }
+  }
+};
+
+#endif // __TRANSPORT_H__
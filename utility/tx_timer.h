@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+ * The cutoff for OneWireSoftSerial's timer driven transmit (_SS_TX_TIMER). It lives here so that
+ * test/tx_timer_test.c checks the same value the driver uses.
+ */
+
+// Below this many cycles per bit, the delay before the TX ISR gets to run (i.e. if another ISR is
+// running) can move an edge too far for the receiver, so the delay loops are used instead.
+#define TX_TIMER_MIN_BIT_TICKS 320